@@ -54,6 +54,12 @@ void json_int(JSONWriter *j, int i)
 	fprintf(j->output, "%d", i);
 }
 
+void json_long(JSONWriter *j, long l)
+{
+	separate(j);
+	fprintf(j->output, "%ld", l);
+}
+
 void
 json_string(JSONWriter *j, const char *s)
 {
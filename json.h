@@ -25,6 +25,7 @@ void json_writer_destroy(JSONWriter *j);
 
 void json_double(JSONWriter *j, double d);
 void json_int(JSONWriter *j, int i);
+void json_long(JSONWriter *j, long l);
 void json_string(JSONWriter *j, const char *s);
 void json_null(JSONWriter *j);
 
@@ -0,0 +1,258 @@
+/*
+ * Tools for making educated word1e guesses.
+ * Copyright (C) 2023 Antonie Blom
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ * USA
+ */
+
+#include <binindex.h>
+#include <dict.h>
+#include <pattern.h>
+#include <second.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define SECTION_ALIGN 64
+
+typedef struct {
+	uint32_t magic, version;
+	uint32_t word_size, attr_size;
+	uint32_t num_words, num_digraphs;
+	uint32_t num_seconds, num_second_top;
+	uint64_t words_off, attrs_off, digraphs_off;
+	uint64_t seconds_off, second_top_off;
+} BinHeader;
+
+typedef struct {
+	uint32_t pattern, num_out, count, first_top;
+	double score;
+} BinSecond;
+
+static uint64_t
+section_after(uint64_t off, uint64_t count, size_t size)
+{
+	off += count * size;
+	return (off + SECTION_ALIGN - 1) / SECTION_ALIGN * SECTION_ALIGN;
+}
+
+static int
+pad_to(FILE *f, uint64_t *pos, uint64_t off)
+{
+	for (; *pos < off; ++*pos)
+		if (fputc(0, f) == EOF)
+			return -1;
+
+	return 0;
+}
+
+int
+binindex_save(const Dict *d, FILE *f)
+{
+	uint32_t num_second_top = 0;
+	for (int i = 0; i < d->num_second_guesses; ++i)
+		num_second_top += d->second_guesses[i].count;
+
+	BinHeader h = {
+		.magic = BINDEX_MAGIC,
+		.version = BINDEX_VERSION,
+		.word_size = sizeof(Word),
+		.attr_size = sizeof(WordAttr),
+		.num_words = d->num_words,
+		.num_digraphs = d->num_digraphs,
+		.num_seconds = d->num_second_guesses,
+		.num_second_top = num_second_top,
+	};
+
+	h.words_off = section_after(0, 1, sizeof(h));
+	h.attrs_off = section_after(h.words_off, h.num_words, sizeof(Word));
+	h.digraphs_off = section_after(h.attrs_off, h.num_words, sizeof(WordAttr));
+	h.seconds_off = section_after(h.digraphs_off, h.num_digraphs, sizeof(Digraph));
+	h.second_top_off = section_after(h.seconds_off, h.num_seconds, sizeof(BinSecond));
+
+	uint64_t pos = sizeof(h);
+	if (fwrite(&h, sizeof(h), 1, f) != 1 || pad_to(f, &pos, h.words_off) < 0)
+		goto fail;
+
+	if (fwrite(d->words, sizeof(Word), h.num_words, f) != h.num_words)
+		goto fail;
+	pos += sizeof(Word) * h.num_words;
+	if (pad_to(f, &pos, h.attrs_off) < 0
+	 || fwrite(d->attrs, sizeof(WordAttr), h.num_words, f) != h.num_words)
+		goto fail;
+	pos += sizeof(WordAttr) * h.num_words;
+	if (pad_to(f, &pos, h.digraphs_off) < 0
+	 || fwrite(d->digraphs, sizeof(Digraph), h.num_digraphs, f) != h.num_digraphs)
+		goto fail;
+	pos += sizeof(Digraph) * h.num_digraphs;
+	if (pad_to(f, &pos, h.seconds_off) < 0)
+		goto fail;
+
+	uint32_t first_top = 0;
+	for (int i = 0; i < d->num_second_guesses; ++i) {
+		const SecondGuess *sg = &d->second_guesses[i];
+		BinSecond bs;
+		memset(&bs, 0, sizeof(bs));
+		bs.pattern = sg->pattern;
+		bs.num_out = sg->num_out;
+		bs.count = sg->count;
+		bs.first_top = first_top;
+		bs.score = sg->score;
+		if (fwrite(&bs, sizeof(bs), 1, f) != 1)
+			goto fail;
+		first_top += sg->count;
+	}
+	pos += sizeof(BinSecond) * h.num_seconds;
+	if (pad_to(f, &pos, h.second_top_off) < 0)
+		goto fail;
+
+	for (int i = 0; i < d->num_second_guesses; ++i) {
+		const SecondGuess *sg = &d->second_guesses[i];
+		for (int j = 0; j < sg->count; ++j) {
+			uint32_t idx = sg->top[j];
+			if (fwrite(&idx, sizeof(idx), 1, f) != 1)
+				goto fail;
+		}
+	}
+
+	return 0;
+
+fail:
+	perror("index");
+	return -1;
+}
+
+static bool
+in_map(const Dict *d, uint64_t off, uint64_t count, size_t size)
+{
+	return off % SECTION_ALIGN == 0 && off <= d->map_size
+	    && count <= (d->map_size - off) / size;
+}
+
+static int
+map_seconds(Dict *d, const BinHeader *h)
+{
+	const BinSecond *seconds = (const BinSecond *)((char *)d->map + h->seconds_off);
+	const uint32_t *second_top = (const uint32_t *)((char *)d->map + h->second_top_off);
+
+	for (uint32_t i = 0; i < h->num_seconds; ++i) {
+		const BinSecond *bs = &seconds[i];
+		if (bs->pattern >= NUM_PATTERNS || bs->count > bs->num_out || bs->num_out > INT32_MAX
+		 || bs->first_top > h->num_second_top || bs->count > h->num_second_top - bs->first_top)
+			return 1;
+
+		int *top = malloc(sizeof(int) * (bs->count + 1));
+		if (top == NULL) {
+			fprintf(stderr, "out of memory\n");
+			return -1;
+		}
+
+		for (uint32_t j = 0; j < bs->count; ++j) {
+			top[j] = second_top[bs->first_top + j];
+			if (second_top[bs->first_top + j] >= h->num_words) {
+				free(top);
+				return 1;
+			}
+		}
+
+		if (append_second_guess(d, bs->pattern, bs->score, bs->num_out, bs->count, top) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+int
+binindex_map(Dict *d, FILE *f)
+{
+	struct stat st;
+	if (fstat(fileno(f), &st) < 0) {
+		perror("index");
+		return -1;
+	}
+
+	if (st.st_size < (off_t)sizeof(BinHeader)) {
+		fprintf(stderr, "error: not a word index\n");
+		return -1;
+	}
+
+	void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fileno(f), 0);
+	if (map == MAP_FAILED) {
+		perror("index");
+		return -1;
+	}
+
+	/* from here on, dict_free unmaps */
+	d->map = map;
+	d->map_size = st.st_size;
+
+	const BinHeader *h = map;
+	if (h->magic != BINDEX_MAGIC) {
+		fprintf(stderr, "error: not a word index\n");
+		return -1;
+	}
+
+	if (h->version != BINDEX_VERSION || h->word_size != sizeof(Word) || h->attr_size != sizeof(WordAttr)) {
+		fprintf(stderr, "error: unsupported binary index version %u\n", h->version);
+		return -1;
+	}
+
+	if (h->num_words > INT32_MAX || h->num_digraphs > 32 - 26
+	 || !in_map(d, h->words_off, h->num_words, sizeof(Word))
+	 || !in_map(d, h->attrs_off, h->num_words, sizeof(WordAttr))
+	 || !in_map(d, h->digraphs_off, h->num_digraphs, sizeof(Digraph))
+	 || !in_map(d, h->seconds_off, h->num_seconds, sizeof(BinSecond))
+	 || !in_map(d, h->second_top_off, h->num_second_top, sizeof(uint32_t)))
+		goto corrupt;
+
+	d->words = (Word *)((char *)map + h->words_off);
+	d->attrs = (WordAttr *)((char *)map + h->attrs_off);
+	d->num_words = h->num_words;
+	d->digraphs = (Digraph *)((char *)map + h->digraphs_off);
+	d->num_digraphs = h->num_digraphs;
+
+	for (int i = 0; i < d->num_digraphs; ++i) {
+		const Digraph *di = &d->digraphs[i];
+		if (di->fst < 'A' || di->fst > 'Z' || di->snd < 'A' || di->snd > 'Z'
+		 || di->repr != 'Z' + i + 1)
+			goto corrupt;
+	}
+
+	/* letter_bit is only defined for letters the index has */
+	int last_code = 'Z' - 'A' + d->num_digraphs;
+	for (int i = 0; i < d->num_words; ++i) {
+		if (d->words[i].packed >> 25)
+			goto corrupt;
+		for (int j = 0; j < 5; ++j)
+			if (word_code(&d->words[i], j) > last_code)
+				goto corrupt;
+
+		if (d->attrs[i].flags & ~(WA_TARGET | WA_EXPLICIT | WA_SLUR))
+			goto corrupt;
+	}
+
+	int rc = map_seconds(d, h);
+	if (rc > 0)
+		goto corrupt;
+
+	return rc;
+
+corrupt:
+	fprintf(stderr, "error: corrupt binary index\n");
+	return -1;
+}
@@ -0,0 +1,196 @@
+/*
+ * Tools for making educated word1e guesses.
+ * Copyright (C) 2023 Antonie Blom
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ * USA
+ */
+
+#ifndef _GNU_SOURCE
+#  define _GNU_SOURCE
+#endif
+
+#include <bitindex.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NUM_SETS (5 * 32 + 32 * BI_MAX_COUNT)
+
+static inline uint64_t *
+at_set(const BitIndex *x, int pos, int letter)
+{
+	return x->sets + (size_t)(pos * 32 + letter) * x->words;
+}
+
+static inline uint64_t *
+min_set(const BitIndex *x, int letter, int count)
+{
+	return x->sets + (size_t)(5 * 32 + letter * BI_MAX_COUNT + count - 1) * x->words;
+}
+
+void
+bitindex_free(BitIndex *x)
+{
+	free(x->alive);
+	free(x->sets);
+	memset(x, 0, sizeof(*x));
+}
+
+int
+bitindex_build(BitIndex *x, const WordPlanes *p)
+{
+	int words = (p->count + 63) / 64;
+	if (words == 0)
+		words = 1;
+
+	uint64_t *alive = calloc(words, sizeof(uint64_t));
+	uint64_t *sets = calloc((size_t)NUM_SETS * words, sizeof(uint64_t));
+	if (alive == NULL || sets == NULL) {
+		fprintf(stderr, "out of memory\n");
+		free(alive);
+		free(sets);
+		return -1;
+	}
+
+	bitindex_free(x);
+	x->count = x->alive_count = p->count;
+	x->words = words;
+	x->alive = alive;
+	x->sets = sets;
+
+	for (int w = 0; w < p->count; ++w) {
+		uint64_t bit = (uint64_t)1 << (w % 64);
+		alive[w / 64] |= bit;
+
+		uint8_t counts[32] = { 0 };
+		for (int i = 0; i < 5; ++i) {
+			int l = p->letters[i][w];
+			at_set(x, i, l)[w / 64] |= bit;
+			x->present[i] |= (uint32_t)1 << l;
+			++counts[l];
+		}
+
+		for (int i = 0; i < 5; ++i) {
+			int l = p->letters[i][w];
+			for (int n = 1; n <= counts[l] && n <= BI_MAX_COUNT; ++n)
+				min_set(x, l, n)[w / 64] |= bit;
+		}
+	}
+
+	return 0;
+}
+
+/* The knowledge as a conjunction of clauses over the index sets: per
+ * constrained position the union of the allowed (or the complement of
+ * the union of the excluded) letter sets, and per known letter the set
+ * of words with at least that many copies. */
+typedef struct {
+	int num_terms[5];
+	bool negate[5];
+	const uint64_t *terms[5][32];
+	int num_mins;
+	const uint64_t *mins[32];
+} Query;
+
+static void
+make_query(Query *q, const BitIndex *x, const Know *know)
+{
+	for (int i = 0; i < 5; ++i) {
+		uint32_t excluded = know->exclude[i] & x->present[i];
+		uint32_t allowed = ~know->exclude[i] & x->present[i];
+
+		q->num_terms[i] = 0;
+		if (excluded == 0) {
+			q->negate[i] = true;
+			continue;
+		}
+
+		q->negate[i] = __builtin_popcount(excluded) < __builtin_popcount(allowed);
+		uint32_t letters = q->negate[i] ? excluded : allowed;
+		for (; letters; letters &= letters - 1)
+			q->terms[i][q->num_terms[i]++] = at_set(x, i, __builtin_ctz(letters));
+	}
+
+	q->num_mins = 0;
+	for (int l = 0; l < 32; ++l) {
+		int n = hist_count(know->hist, 'A' + l);
+		if (n > BI_MAX_COUNT)
+			n = BI_MAX_COUNT;
+		if (n > 0)
+			q->mins[q->num_mins++] = min_set(x, l, n);
+	}
+}
+
+static inline uint64_t
+query_word(const Query *q, const BitIndex *x, int w)
+{
+	uint64_t v = x->alive[w];
+
+	for (int i = 0; i < 5 && v; ++i) {
+		if (q->negate[i] && q->num_terms[i] == 0)
+			continue;
+
+		uint64_t any = 0;
+		for (int t = 0; t < q->num_terms[i]; ++t)
+			any |= q->terms[i][t][w];
+
+		v &= q->negate[i] ? ~any : any;
+	}
+
+	for (int m = 0; m < q->num_mins && v; ++m)
+		v &= q->mins[m][w];
+
+	return v;
+}
+
+int
+bitindex_count(const BitIndex *x, const Know *know)
+{
+	Query q;
+	make_query(&q, x, know);
+
+	int count = 0;
+	for (int w = 0; w < x->words; ++w)
+		count += __builtin_popcountll(query_word(&q, x, w));
+
+	return count;
+}
+
+int
+bitindex_filter(BitIndex *x, const Know *know, uint64_t *keep)
+{
+	Query q;
+	make_query(&q, x, know);
+
+	memset(keep, 0, sizeof(uint64_t) * ((x->alive_count + 63) / 64 + 1));
+
+	int j = 0, count = 0;
+	for (int w = 0; w < x->words; ++w) {
+		uint64_t old = x->alive[w];
+		uint64_t new = query_word(&q, x, w);
+
+		for (; old; old &= old - 1, ++j)
+			if (new & (old & -old))
+				keep[j / 64] |= (uint64_t)1 << (j % 64);
+
+		x->alive[w] = new;
+		count += __builtin_popcountll(new);
+	}
+
+	x->alive_count = count;
+	return count;
+}
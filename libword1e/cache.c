@@ -0,0 +1,275 @@
+/*
+ * Tools for making educated word1e guesses.
+ * Copyright (C) 2023 Antonie Blom
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ * USA
+ */
+
+#include <cache.h>
+#include <game.h>
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NUM_BUCKETS (2 * GUESS_CACHE_SIZE)
+
+typedef struct GuessCache GuessCache;
+
+typedef struct {
+	uint32_t exclude[5];
+	int catalog, num_opts, mode, metric;
+	bool slurs;
+	Histogram hist;
+} CacheKey;
+
+typedef struct {
+	CacheKey key;
+	uint64_t hash;
+	int chain;       /* next entry in the same bucket */
+	int older, newer; /* LRU list */
+
+	double score;
+	int num_out, count;
+	int top[GUESS_CACHE_MAX_TOP];
+} CacheEntry;
+
+struct GuessCache {
+	pthread_mutex_t lock;
+
+	CacheEntry entries[GUESS_CACHE_SIZE];
+	int buckets[NUM_BUCKETS];
+	int num_entries, newest, oldest;
+	long hits, misses;
+};
+
+static void
+make_key(CacheKey *key, const Game *g, const Know *know)
+{
+	/* no padding bytes may differ between equal keys */
+	memset(key, 0, sizeof(*key));
+	memcpy(key->exclude, know->exclude, sizeof(key->exclude));
+	key->hist[0] = know->hist[0];
+	key->hist[1] = know->hist[1];
+	key->catalog = g->opt_catalog;
+	key->num_opts = g->num_opts;
+	key->mode = g->score_mode;
+	key->metric = g->score_metric;
+	key->slurs = g->suggest_slurs;
+}
+
+/* FNV-1a */
+static uint64_t
+hash_key(const CacheKey *key)
+{
+	const uint8_t *bytes = (const uint8_t *)key;
+
+	uint64_t hash = 14695981039346656037ULL;
+	for (size_t i = 0; i < sizeof(*key); ++i) {
+		hash ^= bytes[i];
+		hash *= 1099511628211ULL;
+	}
+
+	return hash;
+}
+
+static int
+find(const GuessCache *c, const CacheKey *key, uint64_t hash)
+{
+	if (c->num_entries == 0)
+		return -1;
+
+	for (int e = c->buckets[hash % NUM_BUCKETS]; e >= 0; e = c->entries[e].chain)
+		if (c->entries[e].hash == hash && !memcmp(&c->entries[e].key, key, sizeof(*key)))
+			return e;
+
+	return -1;
+}
+
+static void
+unlink_lru(GuessCache *c, int e)
+{
+	CacheEntry *ent = &c->entries[e];
+	if (ent->older >= 0)
+		c->entries[ent->older].newer = ent->newer;
+	else
+		c->oldest = ent->newer;
+
+	if (ent->newer >= 0)
+		c->entries[ent->newer].older = ent->older;
+	else
+		c->newest = ent->older;
+}
+
+static void
+push_newest(GuessCache *c, int e)
+{
+	c->entries[e].older = c->newest;
+	c->entries[e].newer = -1;
+	if (c->newest >= 0)
+		c->entries[c->newest].newer = e;
+	else
+		c->oldest = e;
+	c->newest = e;
+}
+
+static void
+unlink_chain(GuessCache *c, int e)
+{
+	int *link = &c->buckets[c->entries[e].hash % NUM_BUCKETS];
+	while (*link != e)
+		link = &c->entries[*link].chain;
+	*link = c->entries[e].chain;
+}
+
+int
+guess_cache_clear(Dict *d)
+{
+	GuessCache *c = d->cache;
+	if (c == NULL) {
+		c = d->cache = malloc(sizeof(GuessCache));
+		if (c == NULL) {
+			fprintf(stderr, "out of memory\n");
+			return -1;
+		}
+
+		pthread_mutex_init(&c->lock, NULL);
+		c->hits = c->misses = 0;
+	}
+
+	pthread_mutex_lock(&c->lock);
+	c->num_entries = 0;
+	c->newest = c->oldest = -1;
+	pthread_mutex_unlock(&c->lock);
+	return 0;
+}
+
+void
+guess_cache_free(Dict *d)
+{
+	if (d->cache == NULL)
+		return;
+
+	pthread_mutex_destroy(&d->cache->lock);
+	free(d->cache);
+	d->cache = NULL;
+}
+
+bool
+guess_cache_lookup(const Game *g, const Know *know, Word *top, int max_out, int *num_out, double *score)
+{
+	GuessCache *c = g->dict->cache;
+	if (c == NULL)
+		return false;
+
+	CacheKey key;
+	make_key(&key, g, know);
+	uint64_t hash = hash_key(&key);
+
+	pthread_mutex_lock(&c->lock);
+
+	int e = find(c, &key, hash);
+	int want = 0;
+	if (e >= 0)
+		want = (c->entries[e].num_out < max_out) ? c->entries[e].num_out : max_out;
+
+	if (e < 0 || c->entries[e].count < want) {
+		++c->misses;
+		pthread_mutex_unlock(&c->lock);
+		return false;
+	}
+
+	++c->hits;
+	unlink_lru(c, e);
+	push_newest(c, e);
+
+	CacheEntry *ent = &c->entries[e];
+	for (int i = 0; i < want; ++i)
+		top[i] = g->dict->words[ent->top[i]];
+	*num_out = ent->num_out;
+	*score = ent->score;
+
+	pthread_mutex_unlock(&c->lock);
+	return true;
+}
+
+void
+guess_cache_store(const Game *g, const Know *know, const int *top, int count, int num_out, double score)
+{
+	GuessCache *c = g->dict->cache;
+	if (c == NULL)
+		return;
+
+	CacheKey key;
+	make_key(&key, g, know);
+	uint64_t hash = hash_key(&key);
+
+	if (count > GUESS_CACHE_MAX_TOP)
+		count = GUESS_CACHE_MAX_TOP;
+
+	pthread_mutex_lock(&c->lock);
+
+	if (c->num_entries == 0)
+		memset(c->buckets, 0xff, sizeof(c->buckets));
+
+	int e = find(c, &key, hash);
+	if (e >= 0) {
+		unlink_lru(c, e);
+		if (count < c->entries[e].count) {
+			push_newest(c, e);
+			pthread_mutex_unlock(&c->lock);
+			return;
+		}
+	} else {
+		if (c->num_entries < GUESS_CACHE_SIZE) {
+			e = c->num_entries++;
+		} else {
+			e = c->oldest;
+			unlink_lru(c, e);
+			unlink_chain(c, e);
+		}
+
+		c->entries[e].key = key;
+		c->entries[e].hash = hash;
+		c->entries[e].chain = c->buckets[hash % NUM_BUCKETS];
+		c->buckets[hash % NUM_BUCKETS] = e;
+	}
+
+	CacheEntry *ent = &c->entries[e];
+	memcpy(ent->top, top, sizeof(int) * count);
+	ent->count = count;
+	ent->num_out = num_out;
+	ent->score = score;
+	push_newest(c, e);
+
+	pthread_mutex_unlock(&c->lock);
+}
+
+void
+guess_cache_stats(Dict *d, long *hits_out, long *misses_out)
+{
+	*hits_out = *misses_out = 0;
+
+	GuessCache *c = d->cache;
+	if (c == NULL)
+		return;
+
+	pthread_mutex_lock(&c->lock);
+	*hits_out = c->hits;
+	*misses_out = c->misses;
+	pthread_mutex_unlock(&c->lock);
+}
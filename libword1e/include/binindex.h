@@ -0,0 +1,19 @@
+#pragma once
+
+#include <word.h>
+
+#define BINDEX_MAGIC   0x58453157 /* "W1EX" */
+#define BINDEX_VERSION 2
+
+/* The index in the layout the library keeps it in memory, so that it
+ * can be mapped instead of parsed: the packed words,
+ * attributes and digraphs are used in place, and the pages are shared
+ * by every process that has the index open. Only the second guesses
+ * are copied out. Like decision trees, binary indices are in host
+ * byte order and struct layout, which the header records. */
+int binindex_save(const Dict *d, FILE *f);
+
+/* Maps the binary index f was opened on into d, which must be empty.
+ * load_index calls this for files that don't look like text
+ * indices. */
+int binindex_map(Dict *d, FILE *f);
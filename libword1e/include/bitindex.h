@@ -0,0 +1,24 @@
+#pragma once
+
+#include <planes.h>
+
+#define BI_MAX_COUNT 4 /* a Histogram counts up to four copies */
+
+/* Inverted index over a word list: for every (position, letter) pair
+ * and every minimum letter count, the set of words that have it.
+ * Words are dropped from `alive' as the list gets filtered; the index
+ * is rebuilt over the remaining words once it gets sparse. */
+typedef struct {
+	int count, words, alive_count;
+	uint32_t present[5]; /* letters occurring at each position */
+	uint64_t *alive;
+	uint64_t *sets;
+} BitIndex;
+
+int bitindex_build(BitIndex *x, const WordPlanes *p);
+void bitindex_free(BitIndex *x);
+int bitindex_count(const BitIndex *x, const Know *know);
+
+/* Drops the words not matching know. Bit j of keep is set iff the j-th
+ * word that was alive still is. Returns the number of words left. */
+int bitindex_filter(BitIndex *x, const Know *know, uint64_t *keep);
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <word.h>
+
+#define GUESS_CACHE_SIZE    1024 /* states kept */
+#define GUESS_CACHE_MAX_TOP 64   /* guesses kept per state */
+
+/* Bounded LRU cache of best_guesses results per Dict, keyed by the
+ * knowledge together with everything else of the game the result
+ * depends on (the option catalog and count, whether slurs are
+ * suggested, the score mode and the metric).
+ * Safe to use from several threads. */
+
+/* Fills top, num_out and score if the state is cached with enough
+ * guesses for max_out, and returns whether it was. */
+bool guess_cache_lookup(const Game *g, const Know *know, Word *top, int max_out, int *num_out, double *score);
+
+/* Stores the dict indices of (up to GUESS_CACHE_MAX_TOP of) the first
+ * count best guesses out of num_out. */
+void guess_cache_store(const Game *g, const Know *know, const int *top, int count, int num_out, double score);
+
+/* Must be called whenever the words of d change. */
+int guess_cache_clear(Dict *d);
+void guess_cache_free(Dict *d);
+void guess_cache_stats(Dict *d, long *hits, long *misses);
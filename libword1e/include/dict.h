@@ -0,0 +1,55 @@
+#pragma once
+
+#include <word.h>
+#include <planes.h>
+#include <second.h>
+
+#include <pthread.h>
+
+typedef struct {
+	uint32_t key; /* Word.packed */
+	int idx;      /* -1 if the slot is free */
+} WordSlot;
+
+/* A word index. Only the caches change once it is loaded, and they
+ * lock themselves, so any number of games (and threads) may share
+ * one. */
+struct Dict {
+	Word *words;
+	WordAttr *attrs;
+	int num_words;
+	Digraph *digraphs;
+	int num_digraphs;
+	WordPlanes planes;
+
+	/* for index_of_word */
+	WordSlot *word_table;
+	uint32_t word_table_mask;
+
+	/* words, attrs and digraphs point into this if the index is
+	 * binary (see binindex.h) */
+	void *map;
+	size_t map_size;
+
+	SecondGuess *second_guesses;
+	int num_second_guesses;
+
+	/* see pattern.h */
+	pthread_mutex_t matrix_lock;
+	uint8_t *pattern_matrix;
+	int *pattern_cols, num_pattern_cols;
+	long pairs_computed, matrix_pairs;
+
+	struct GuessCache *cache;
+	struct OptimalMemo *optimal;
+};
+
+/* Sets up an empty index. */
+void dict_init(Dict *d);
+void dict_free(Dict *d);
+
+int load_index(Dict *d, FILE *f);
+
+/* Sets up everything derived from words, attrs and num_words, as
+ * load_index does after reading them. */
+int init_index(Dict *d);
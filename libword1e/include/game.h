@@ -0,0 +1,58 @@
+#pragma once
+
+#include <dict.h>
+#include <bitindex.h>
+#include <optimal.h>
+#include <score.h>
+
+enum option_catalog {
+	OC_NONE,
+	OC_TARGET,
+	OC_ALL,
+};
+
+/* The words one game may still be looking for, and how it picks its
+ * guesses. Games only read their Dict. */
+struct Game {
+	Dict *dict;
+
+	int *opts; /* dict->words indices, in dict order */
+	int num_opts, opt_capacity;
+	enum option_catalog opt_catalog;
+	WordPlanes opt_planes;
+	BitIndex opt_index;
+
+	bool suggest_slurs;
+	enum score_mode score_mode;
+	enum score_metric score_metric;
+	enum optimal_objective optimal_objective;
+	int optimal_width; /* 0 for an exact search, see optimal.h */
+
+	ScoreStats *stats; /* NULL unless collecting */
+};
+
+static inline const Word *
+opt_word(const Game *g, int j)
+{
+	return &g->dict->words[g->opts[j]];
+}
+
+/* Starts a game on d with the default settings, with every target as
+ * an option. */
+int game_init(Game *g, Dict *d);
+
+/* Starts a game on the index of from, with its settings, that has
+ * gathered know. */
+int game_init_from(Game *g, const Game *from, const Know *know);
+void game_free(Game *g);
+
+/* Drops the options that don't match know, in place. Returns -1 if
+ * out of memory, which leaves them as they were. */
+int filter_opts(Game *g, const Know *know);
+
+/* Narrows the options down to know. Returns the number of them that
+ * were eliminated, or -1. */
+int update_opts(Game *g, const Know *know);
+
+/* Sets opts as if know had been gathered from scratch. */
+int reset_opts(Game *g, const Know *know);
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <word.h>
+
+enum optimal_objective {
+	OO_EXPECTED, /* fewest guesses on average */
+	OO_WORST,    /* fewest guesses in the worst case */
+};
+
+/* Cost of finding any of the targets (dict indices) with optimal play
+ * under g's objective: the total number of guesses over all targets
+ * for OO_EXPECTED, the largest number for OO_WORST. Game.optimal_width
+ * is the number of guesses tried per state, best first by how evenly
+ * they split the targets; 0 tries all of them, which makes the search
+ * exact. Any other width makes it a heuristic: the cost is that of the
+ * best play it found, which may not be optimal. Sets *guess_out to the
+ * dict index of the guess to play first. Returns -1 on error. */
+long optimal_guess(const Game *g, const int *targets, int num_targets, int *guess_out);
+
+/* optimal_guess for the options of g, like best_guesses. Returns the
+ * expected (or worst case) number of guesses left, or -1. */
+double optimal_guesses(const Game *g, Word *top, int max_out, int *num_out);
+
+/* Forgets all states solved so far on d. */
+int optimal_reset(Dict *d);
+void optimal_free(Dict *d);
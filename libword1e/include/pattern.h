@@ -0,0 +1,40 @@
+#pragma once
+
+#include <dict.h>
+
+#define NUM_PATTERNS      243
+#define ALL_GREEN_PATTERN 121 /* pattern_code of five greens */
+
+/* The pattern matrix of a Dict holds the feedback of every guess
+ * against every target word, one base-3 code per pair: row `guess'
+ * (index into words), column pattern_cols[target] (-1 if
+ * words[target] is no target). */
+
+static inline uint8_t
+pattern_code(const uint8_t *wc)
+{
+	return wc[0] + 3 * (wc[1] + 3 * (wc[2] + 3 * (wc[3] + 3 * wc[4])));
+}
+
+static inline void
+pattern_colors(WordColor out, uint8_t code)
+{
+	for (int i = 0; i < 5; ++i) {
+		out[i] = code % 3;
+		code /= 3;
+	}
+}
+
+static inline const uint8_t *
+pattern_row(const Dict *d, int guess_idx)
+{
+	return d->pattern_matrix + (size_t)guess_idx * d->num_pattern_cols;
+}
+
+/* Both return -1 if the matrix isn't there, which is always the case
+ * for dicts of more than 2^30 pairs: callers then compute the patterns
+ * they need with word_pattern. use_pattern_matrix only builds it once
+ * the `pairs' of all calls add up to its size. */
+int build_pattern_matrix(Dict *d);
+int use_pattern_matrix(Dict *d, long pairs);
+void free_pattern_matrix(Dict *d);
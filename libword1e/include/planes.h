@@ -0,0 +1,35 @@
+#pragma once
+
+#include <word.h>
+
+/* Structure-of-arrays copy of a word list, padded to a multiple of 64
+ * words so that the match kernels can test whole blocks at once. */
+typedef struct {
+	int count, capacity;
+	uint8_t *letters[5]; /* letter - 'A' at each position */
+	uint64_t *hist[2];
+} WordPlanes;
+
+static inline int
+planes_blocks(const WordPlanes *p)
+{
+	return (p->count + 63) / 64;
+}
+
+int planes_load(WordPlanes *p, const Word *words, int count);
+/* planes_load for words[ids[0]], ..., words[ids[count - 1]]. */
+int planes_gather(WordPlanes *p, const Word *words, const int *ids, int count);
+void planes_free(WordPlanes *p);
+
+/* Sets bit i of mask iff word i matches know. mask must hold
+ * planes_blocks(p) words. */
+void planes_match(uint64_t *mask, const WordPlanes *p, const Know *know);
+int planes_count(const WordPlanes *p, const Know *know);
+
+/* Sets codes[k] to word_pattern(guess, word from * 64 + k) for the
+ * words of blocks [from, to). codes must hold 64 codes per block;
+ * those for the padding past the last word are meaningless. */
+void planes_patterns(uint8_t *codes, const WordPlanes *p, const Word *guess, int from, int to);
+
+/* Keeps only the words whose bit is set in mask. */
+void planes_compact(WordPlanes *p, const uint64_t *mask);
@@ -1,9 +1,88 @@
 #pragma once
 
 #include <word.h>
+#include <threadpool.h>
 
-int count_opts(const Know *know);
-double score_guess(const Word *guess, const Know *know);
-double score_guess_with_attr(const Word *guess, const WordAttr *attr, const Know *know);
-double score_guess_st(const Word *guess, const WordAttr *attr, const Know *know, double break_at);
-double best_guesses(Word *top, int max_out, int *num_out, const Know *know);
+#include <stdatomic.h>
+
+enum score_mode {
+	SM_SIMULATE,  /* count options left after each simulated target */
+	SM_PARTITION, /* bucket options by feedback pattern */
+};
+
+/* What best_guesses ranks guesses by (Game.score_metric). Higher
+ * scores are better, so the metrics of which less is better are
+ * negated. Only MT_SQUARES follows score_mode; the others always
+ * partition the options. */
+enum score_metric {
+	MT_SQUARES,    /* 1 minus the expected fraction of options left */
+	MT_ENTROPY,    /* bits of information in the feedback */
+	MT_EXPECTED,   /* options expected to be left */
+	MT_MAX_BUCKET, /* options left after the worst feedback */
+	MT_BUCKETS,    /* distinct feedbacks */
+	NUM_METRICS,
+};
+
+/* Every metric of a guess, from a single pass over the options. The
+ * all green feedback leaves no options in expected. */
+typedef struct {
+	double squares, entropy, expected;
+	int max_bucket, buckets;
+} ScoreMetrics;
+
+/* Name of a metric as given on the command line, and back; returns -1
+ * for unknown names. */
+const char *score_metric_name(enum score_metric metric);
+int score_metric_from_name(const char *name);
+
+int cpu_count(void);
+threadpool_t *score_pool(void);
+int count_opts(const Game *g, const Know *know);
+double score_guess(const Game *g, const Word *guess, const Know *know);
+double score_guess_with_attr(const Game *g, const Word *guess, const WordAttr *attr, const Know *know);
+double score_guess_st(const Game *g, const Word *guess, const WordAttr *attr, const Know *know, double break_at);
+void score_guess_metrics(const Game *g, ScoreMetrics *m, const Word *guess, const Know *know);
+double metric_score(const ScoreMetrics *m, enum score_metric metric);
+double best_guesses(const Game *g, Word *top, int max_out, int *num_out, const Know *know);
+
+/* What the scoring for a game has done, counted while Game.stats
+ * points here. Any number of threads may add to it. Times are in
+ * nanoseconds. */
+typedef struct {
+	_Atomic long guesses;       /* guesses scored */
+	_Atomic long targets;       /* options they were compared with */
+	_Atomic long breaks;        /* scorings cut short by break_at */
+	_Atomic long break_targets; /* options compared by those */
+
+	_Atomic long calls;    /* best_guesses calls */
+	_Atomic long searches; /* of which had to score guesses */
+	_Atomic long shortcut_ns, candidates_ns, scoring_ns, merge_ns;
+
+	/* per search, summed */
+	_Atomic long task_max_ns, task_mean_ns;
+} ScoreStats;
+
+void score_stats_reset(ScoreStats *st);
+
+/* Options compared before a scoring was cut short, on average. */
+double score_stats_break_depth(const ScoreStats *st);
+
+/* Time of the slowest scoring task over that of the average one; 1 if
+ * the pool was evenly loaded. */
+double score_stats_imbalance(const ScoreStats *st);
+
+void score_stats_print(const ScoreStats *st, FILE *f);
+
+/* best_guesses for each of count knowledge states, with the settings
+ * of g and the options matching each state. The guesses for knows[i]
+ * go to top[i * max_out], up to max_out of them. Runs the scoring of
+ * all states as one batch, which keeps the pool busy where separate
+ * calls would each wait for their slowest task. Returns 0, or -1 on
+ * error. */
+int best_guesses_batch(const Game *g,
+                       const Know *knows,
+                       int count,
+                       Word *top,
+                       int max_out,
+                       int *num_out,
+                       double *scores);
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <word.h>
+
+#define SECOND_MAX_TOP 64 /* guesses kept per feedback */
+
+/* best_guesses after playing words[0] first, for every feedback
+ * that leaves options. Stored in the index as
+ *
+ *     #SECOND <colors> <score> <num_out> <count> <word>...
+ *
+ * with colors spelled as in `BYGBB' and only the first count of the
+ * num_out best guesses listed. Only valid for the default score
+ * mode and metric without slurs, which is what mkwx computes them
+ * for. */
+typedef struct {
+	uint8_t pattern;
+	Know know;
+	double score;
+	int num_out, count;
+	int *top; /* words indices of the first count */
+
+	/* the options it was computed for, as in the best_guesses cache
+	 * key; not stored in the index */
+	int opt_catalog, num_opts;
+} SecondGuess;
+
+int compute_second_guesses(Dict *d);
+void free_second_guesses(Dict *d);
+int read_second_guesses(Dict *d, FILE *f, int *line);
+void write_second_guesses(const Dict *d, FILE *f);
+
+/* Adds an entry for having got pattern after words[0], taking over
+ * top, which holds count words indices. */
+int append_second_guess(Dict *d, int pattern, double score, int num_out, int count, int *top);
+
+/* Sets num_opts of the entries, once they are all there. */
+int count_second_guess_opts(Dict *d);
+
+/* The entry whose knowledge is know, or NULL if there is none or it
+ * doesn't apply to the settings or options of g. */
+const SecondGuess *find_second_guess(const Game *g, const Know *know);
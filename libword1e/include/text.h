@@ -0,0 +1,28 @@
+#pragma once
+
+#include <word.h>
+
+/* The rest of a text file, from where it was at, in memory: mapped if
+ * it is a regular file, read otherwise. */
+typedef struct {
+	const char *buf;
+	size_t size;
+
+	void *map;
+	size_t map_size;
+	char *copy;
+} Text;
+
+int text_open(Text *t, FILE *f);
+void text_close(Text *t);
+
+/* Decodes a word list, words separated by whitespace, as scan_word
+ * would. Large lists are split across the score pool. Returns the
+ * number of words, or -1. */
+ssize_t text_words(const Dict *d, const Text *t, Word **words_out);
+
+/* Decodes the d->num_words lines of a text index that follow its
+ * header into d->words and d->attrs, which must be allocated. *line
+ * is the line number of the first one, and is advanced past them.
+ * Returns the number of bytes they take up, or -1. */
+long text_entries(Dict *d, const Text *t, int *line);
@@ -28,6 +28,8 @@
 
 #pragma once
 
+#include <stddef.h>
+
 /**
  * @file threadpool.h
  * @brief Threadpool Header File
@@ -76,6 +78,22 @@ threadpool_t *threadpool_create(int thread_count, int queue_size, int flags);
  */
 int threadpool_add(threadpool_t *pool, void (*routine)(void *), void *arg, int flags);
 
+/**
+ * @function threadpool_run
+ * @brief run a batch of tasks on a thread pool and wait for all of them
+ * @param pool    Thread pool to run the batch on (NULL runs it inline).
+ * @param routine Function performing each task.
+ * @param args    Array of count task arguments, size bytes apart.
+ * @param count   Number of tasks.
+ * @param size    Size of each argument.
+ * @return 0 if all goes well, negative values in case of error (@see
+ * threadpool_error_t for codes).
+ *
+ * The calling thread works on the batch as well, so batches may be run
+ * from within tasks of the same pool.
+ */
+int threadpool_run(threadpool_t *pool, void (*routine)(void *), void *args, int count, size_t size);
+
 /**
  * @function threadpool_destroy
  * @brief Stops and destroys a thread pool.
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <word.h>
+
+#define TREE_MAX_DEPTH 32
+
+/* A guessing policy expanded over every feedback a target word
+ * can give. Node 0 is the state without knowledge; following the edge
+ * for the word played and the feedback it got leads to the next state.
+ * States no target word can reach have no node. */
+typedef struct {
+	double score;
+	uint32_t first_best, num_best; /* best guesses, in best_guesses order */
+	uint32_t first_edge, num_edges;
+} TreeNode;
+
+typedef struct {
+	uint32_t guess; /* words index */
+	uint32_t pattern;
+	uint32_t child;
+} TreeEdge;
+
+typedef struct {
+	uint32_t num_nodes, num_edges, num_best;
+	TreeNode *nodes;
+	TreeEdge *edges; /* sorted by guess, then pattern, per node */
+	uint32_t *best;  /* words indices */
+} DecisionTree;
+
+enum tree_policy {
+	TP_GREEDY,  /* best_guesses */
+	TP_OPTIMAL, /* optimal_guess, one best guess per node */
+};
+
+/* Builds the tree for the index of g, playing with its settings. From
+ * the root, the best guess and the first num_openers words are
+ * expanded; from any other node only its best guess. */
+int tree_build(DecisionTree *t, const Game *g, int num_openers, enum tree_policy policy);
+void tree_free(DecisionTree *t);
+
+/* Trees are only valid for the index they were built from, which
+ * tree_load checks. */
+int tree_save(const DecisionTree *t, const Dict *d, FILE *f);
+int tree_load(DecisionTree *t, const Dict *d, FILE *f);
+
+/* The best guesses as recorded in node. */
+double tree_best(const DecisionTree *t, const Dict *d, int node, Word *top, int max_out, int *num_out);
+
+/* Node reached by playing words[guess_idx] in node and getting colors,
+ * or -1 if there is none. */
+int tree_child(const DecisionTree *t, int node, int guess_idx, WordColor colors);
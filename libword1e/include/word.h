@@ -6,9 +6,11 @@
 
 #include <hist.h>
 
+/* Five letters of five bits each, letter - 'A', the first in the
+ * highest bits so that words sort alphabetically. Digraphs take the
+ * codes after Z. */
 typedef struct {
-	char letters[5];
-	Histogram hist;
+	uint32_t packed;
 } Word;
 
 typedef struct {
@@ -16,15 +18,27 @@ typedef struct {
 	Histogram hist;
 } Know;
 
+enum {
+	WA_TARGET   = 0x1, /* may be a target word */
+	WA_EXPLICIT = 0x2, /* word may be considered explicit */
+	WA_SLUR     = 0x4, /* word is a slur */
+};
+
+/* Indices keep starting scores to six decimals, which fit in
+ * millionths. */
+#define ATTR_SCORE_ONE 1000000
+
 typedef struct {
-	double starting_score;
-	enum {
-		WA_TARGET   = 0x1, /* may be a target word */
-		WA_EXPLICIT = 0x2, /* word may be considered explicit */
-		WA_SLUR     = 0x4, /* word is a slur */
-	} flags;
+	uint32_t starting_score : 24; /* millionths, see attr_score */
+	uint32_t flags : 8;
 } WordAttr;
 
+static inline double
+attr_score(const WordAttr *attr)
+{
+	return attr->starting_score / (double)ATTR_SCORE_ONE;
+}
+
 #define DARK_COLOR   0
 #define GREEN_COLOR  1
 #define YELLOW_COLOR 2
@@ -35,22 +49,14 @@ typedef struct {
 	char fst, snd, repr;
 } Digraph;
 
-enum option_catalog {
-	OC_NONE,
-	OC_TARGET,
-	OC_ALL,
-};
+/* A loaded index (see dict.h), and one game played on it (game.h). */
+typedef struct Dict Dict;
+typedef struct Game Game;
 
-extern Word *all_words, *opts;
-extern Digraph *digraphs;
-extern WordAttr *word_attrs;
-extern int num_opts, num_words, verbosity, num_digraphs;
-extern enum option_catalog opt_catalog;
-extern bool suggest_slurs;
+extern int verbosity;
 
-int scan_word(FILE *f, Word *out);
-ssize_t load_words(FILE *f, Word **words_out);
-int load_index(FILE *f);
+int scan_word(const Dict *d, FILE *f, Word *out);
+ssize_t load_words(const Dict *d, FILE *f, Word **words_out);
 
 static inline uint32_t
 letter_bit(char letter)
@@ -64,15 +70,52 @@ bit_letter(uint32_t bit)
 	return __builtin_ctz(bit) + 'A';
 }
 
-int index_of_word(const Word *word);
+/* Code of the letter at position i: letter - 'A'. */
+static inline int
+word_code(const Word *word, int i)
+{
+	return word->packed >> (5 * (4 - i)) & 0x1f;
+}
+
+static inline char
+word_letter(const Word *word, int i)
+{
+	return 'A' + word_code(word, i);
+}
+
+static inline void
+word_set_letter(Word *word, int i, char letter)
+{
+	int shift = 5 * (4 - i);
+	word->packed = (word->packed & ~((uint32_t)0x1f << shift)) | (uint32_t)(letter - 'A') << shift;
+}
+
+/* The histogram as hist_add_letter would build it: the n-th copy of
+ * a letter sets bit n - 1 of its nibble. */
+static inline void
+word_hist(const Word *word, Histogram hist)
+{
+	hist[0] = hist[1] = 0;
+	for (int i = 0; i < 5; ++i) {
+		int l = word_code(word, i), copies = 0;
+		for (int j = 0; j < i; ++j)
+			copies += word_code(word, j) == l;
+		if (copies < 4)
+			hist[l >> 4] |= (uint64_t)1 << ((l & 0xf) * 4 + copies);
+	}
+}
+
+int index_of_word(const Dict *d, const Word *word);
 bool has_no_knowledge(const Know *know);
 bool word_matches(const Word *word, const Know *know);
-void filter_opts(const Know *know);
-int update_opts(const Know *know);
 bool all_green(WordColor wc);
 void compare_to_target(WordColor out, const Word *guess, const Word *target);
+
+/* pattern_code (see pattern.h) of the colors compare_to_target
+ * gives. */
+uint8_t word_pattern(const Word *guess, const Word *target);
 int knowledge_from_colors(Know *know, const Word *guess, WordColor colors);
 int absorb_knowledge(Know *know, const Know *other);
 void print_know(const Know *k);
-void print_wordch(FILE *f, char ch, char nxt);
-void print_word(FILE *f, const Word *word);
+void print_wordch(const Dict *d, FILE *f, char ch, char nxt);
+void print_word(const Dict *d, FILE *f, const Word *word);
@@ -0,0 +1,644 @@
+/*
+ * Tools for making educated word1e guesses.
+ * Copyright (C) 2023 Antonie Blom
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ * USA
+ */
+
+#include <optimal.h>
+#include <game.h>
+#include <pattern.h>
+#include <planes.h>
+#include <score.h>
+#include <threadpool.h>
+
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MEMO_MAX_ENTRIES (1 << 24)
+
+/* The targets of a top-level search and the feedback they give to
+ * every guess. Sets of targets below are ascending positions in
+ * targets, which keeps them canonical. */
+typedef struct {
+	const Game *g;
+	struct OptimalMemo *memo;
+	int settings; /* the parts of g that change costs */
+	const int *targets;
+	int num_targets;
+	int *guesses; /* words indices */
+	int num_guesses;
+	uint8_t *codes; /* codes[guess * num_targets + target] */
+} Problem;
+
+typedef struct {
+	uint64_t hash;
+	int settings;
+	int n, *ids; /* words indices */
+	long cost;   /* exact if guess >= 0, else a lower bound */
+	int guess;
+	int next;
+} MemoEntry;
+
+/* Solved states of every game on a dict, whatever its settings. */
+struct OptimalMemo {
+	pthread_mutex_t lock;
+	MemoEntry *entries;
+	int count, cap, num_buckets, *buckets;
+};
+
+static uint64_t
+hash_set(const Problem *p, const int *set, int n)
+{
+	uint64_t hash = 14695981039346656037ULL ^ (uint64_t)p->settings;
+	hash *= 1099511628211ULL;
+	for (int i = 0; i < n; ++i) {
+		hash ^= (uint64_t)p->targets[set[i]];
+		hash *= 1099511628211ULL;
+	}
+
+	return hash;
+}
+
+static int
+memo_find(const Problem *p, const int *set, int n, uint64_t hash)
+{
+	const struct OptimalMemo *m = p->memo;
+	if (m->num_buckets == 0)
+		return -1;
+
+	for (int e = m->buckets[hash & (m->num_buckets - 1)]; e >= 0; e = m->entries[e].next) {
+		const MemoEntry *entry = &m->entries[e];
+		if (entry->hash != hash || entry->n != n || entry->settings != p->settings)
+			continue;
+
+		int i = 0;
+		while (i < n && entry->ids[i] == p->targets[set[i]])
+			++i;
+		if (i == n)
+			return e;
+	}
+
+	return -1;
+}
+
+static bool
+memo_lookup(const Problem *p, const int *set, int n, long *cost, int *guess)
+{
+	uint64_t hash = hash_set(p, set, n);
+
+	pthread_mutex_lock(&p->memo->lock);
+	int e = memo_find(p, set, n, hash);
+	if (e >= 0) {
+		*cost = p->memo->entries[e].cost;
+		*guess = p->memo->entries[e].guess;
+	}
+	pthread_mutex_unlock(&p->memo->lock);
+
+	return e >= 0;
+}
+
+static int
+memo_grow(struct OptimalMemo *m)
+{
+	if (m->count < m->cap)
+		return 0;
+
+	int cap = m->cap ? 2 * m->cap : 4096;
+	MemoEntry *new_entries = realloc(m->entries, sizeof(MemoEntry) * cap);
+	int *new_buckets = malloc(sizeof(int) * cap);
+	if (new_entries == NULL || new_buckets == NULL) {
+		if (new_entries != NULL)
+			m->entries = new_entries;
+		free(new_buckets);
+		return -1;
+	}
+
+	m->entries = new_entries;
+	m->cap = cap;
+
+	free(m->buckets);
+	m->buckets = new_buckets;
+	m->num_buckets = cap;
+	memset(m->buckets, 0xff, sizeof(int) * m->num_buckets);
+	for (int e = 0; e < m->count; ++e) {
+		int *b = &m->buckets[m->entries[e].hash & (m->num_buckets - 1)];
+		m->entries[e].next = *b;
+		*b = e;
+	}
+
+	return 0;
+}
+
+static void
+memo_store(const Problem *p, const int *set, int n, long cost, int guess)
+{
+	uint64_t hash = hash_set(p, set, n);
+	struct OptimalMemo *m = p->memo;
+
+	pthread_mutex_lock(&m->lock);
+
+	int e = memo_find(p, set, n, hash);
+	if (e >= 0) {
+		MemoEntry *entry = &m->entries[e];
+		if (entry->guess < 0 && (guess >= 0 || cost > entry->cost)) {
+			entry->cost = cost;
+			entry->guess = guess;
+		}
+	} else if (m->count < MEMO_MAX_ENTRIES && memo_grow(m) == 0) {
+		int *ids = malloc(sizeof(int) * n);
+		if (ids != NULL) {
+			for (int i = 0; i < n; ++i)
+				ids[i] = p->targets[set[i]];
+
+			e = m->count++;
+			m->entries[e] = (MemoEntry){ hash, p->settings, n, ids, cost, guess, -1 };
+
+			int *b = &m->buckets[hash & (m->num_buckets - 1)];
+			m->entries[e].next = *b;
+			*b = e;
+		}
+	}
+
+	pthread_mutex_unlock(&m->lock);
+}
+
+static void
+memo_clear(struct OptimalMemo *m)
+{
+	for (int e = 0; e < m->count; ++e)
+		free(m->entries[e].ids);
+	free(m->entries);
+	free(m->buckets);
+
+	m->entries = NULL;
+	m->buckets = NULL;
+	m->count = m->cap = m->num_buckets = 0;
+}
+
+int
+optimal_reset(Dict *d)
+{
+	if (d->optimal == NULL) {
+		d->optimal = calloc(1, sizeof(struct OptimalMemo));
+		if (d->optimal == NULL) {
+			fprintf(stderr, "out of memory\n");
+			return -1;
+		}
+
+		pthread_mutex_init(&d->optimal->lock, NULL);
+		return 0;
+	}
+
+	pthread_mutex_lock(&d->optimal->lock);
+	memo_clear(d->optimal);
+	pthread_mutex_unlock(&d->optimal->lock);
+	return 0;
+}
+
+void
+optimal_free(Dict *d)
+{
+	if (d->optimal == NULL)
+		return;
+
+	memo_clear(d->optimal);
+	pthread_mutex_destroy(&d->optimal->lock);
+	free(d->optimal);
+	d->optimal = NULL;
+}
+
+/* Every target but the one guessed takes at least two guesses. */
+static long
+lower_bound(const Problem *p, int n)
+{
+	if (p->g->optimal_objective == OO_WORST)
+		return (n > 1) ? 2 : 1;
+	return 2L * n - 1;
+}
+
+typedef struct {
+	long key;
+	int guess;
+} Ranked;
+
+static int
+compare_ranked(const void *a, const void *b)
+{
+	const Ranked *x = a, *y = b;
+	if (x->key != y->key)
+		return (x->key > y->key) - (x->key < y->key);
+	return x->guess - y->guess;
+}
+
+/* Guesses (positions in p->guesses) worth trying for set, the ones
+ * splitting it into the smallest parts first. Guesses that tell the
+ * targets apart no better than not guessing are left out. */
+static int
+rank_guesses(const Problem *p, const int *set, int n, int **out)
+{
+	Ranked *ranked = malloc(sizeof(Ranked) * (p->num_guesses + 1));
+	if (ranked == NULL)
+		return -1;
+
+	int counts[NUM_PATTERNS] = { 0 };
+	int num_ranked = 0;
+	for (int g = 0; g < p->num_guesses; ++g) {
+		const uint8_t *row = p->codes + (size_t)g * p->num_targets;
+
+		long sum = 0;
+		int max = 0;
+		for (int i = 0; i < n; ++i) {
+			int c = counts[row[set[i]]]++;
+			sum += 2 * c + 1;
+			if (c + 1 > max)
+				max = c + 1;
+		}
+
+		int green = counts[ALL_GREEN_PATTERN];
+		for (int i = 0; i < n; ++i)
+			counts[row[set[i]]] = 0;
+
+		if (max == n && green == 0)
+			continue;
+
+		/* a target guessed right saves a guess */
+		ranked[num_ranked].key = 2 * sum - green;
+		ranked[num_ranked].guess = g;
+		++num_ranked;
+	}
+
+	qsort(ranked, num_ranked, sizeof(Ranked), compare_ranked);
+
+	int width = p->g->optimal_width;
+	if (width > 0 && num_ranked > width)
+		num_ranked = width;
+
+	*out = malloc(sizeof(int) * (num_ranked + 1));
+	if (*out == NULL) {
+		free(ranked);
+		return -1;
+	}
+
+	for (int i = 0; i < num_ranked; ++i)
+		(*out)[i] = ranked[i].guess;
+
+	free(ranked);
+	return num_ranked;
+}
+
+static long solve(const Problem *p, const int *set, int n, long beta);
+
+typedef struct {
+	int start, size;
+} Part;
+
+/* Cost of set when playing guess g first, if less than beta; otherwise
+ * some lower bound of at least beta. -1 if out of memory. */
+static long
+eval_guess(const Problem *p, const int *set, int n, int g, long beta)
+{
+	const uint8_t *row = p->codes + (size_t)g * p->num_targets;
+
+	int start[NUM_PATTERNS + 1] = { 0 };
+	for (int i = 0; i < n; ++i)
+		++start[row[set[i]] + 1];
+	for (int c = 0; c < NUM_PATTERNS; ++c)
+		start[c + 1] += start[c];
+
+	Part parts[NUM_PATTERNS];
+	int num_parts = 0;
+	for (int c = 0; c < NUM_PATTERNS; ++c) {
+		int size = start[c + 1] - start[c];
+		if (size == 0 || c == ALL_GREEN_PATTERN)
+			continue;
+
+		/* biggest first, they decide most cutoffs */
+		int j = num_parts++;
+		while (j > 0 && parts[j - 1].size < size) {
+			parts[j] = parts[j - 1];
+			--j;
+		}
+		parts[j] = (Part){ start[c], size };
+	}
+
+	bool worst = p->g->optimal_objective == OO_WORST;
+
+	long partial = worst ? 1 : n;
+	for (int i = 0; i < num_parts; ++i) {
+		long lb = lower_bound(p, parts[i].size);
+		if (worst)
+			partial = (1 + lb > partial) ? 1 + lb : partial;
+		else
+			partial += lb;
+	}
+
+	if (partial >= beta)
+		return partial;
+
+	int *sorted = malloc(sizeof(int) * n);
+	if (sorted == NULL)
+		return -1;
+
+	int next[NUM_PATTERNS];
+	memcpy(next, start, sizeof(next));
+	for (int i = 0; i < n; ++i)
+		sorted[next[row[set[i]]]++] = set[i];
+
+	for (int i = 0; i < num_parts && partial < beta; ++i) {
+		const int *child = sorted + parts[i].start;
+		int size = parts[i].size;
+		long lb = lower_bound(p, size);
+
+		long cost = solve(p, child, size, worst ? beta - 1 : beta - (partial - lb));
+		if (cost < 0) {
+			partial = -1;
+			break;
+		}
+
+		if (!worst)
+			partial += cost - lb;
+		else if (1 + cost > partial)
+			partial = 1 + cost;
+	}
+
+	free(sorted);
+	return partial;
+}
+
+/* Cost of set if less than beta; otherwise some lower bound of at
+ * least beta. -1 if out of memory, in which case nothing below set
+ * is remembered either. */
+static long
+solve(const Problem *p, const int *set, int n, long beta)
+{
+	if (n == 1)
+		return 1;
+	if (n == 2)
+		return (p->g->optimal_objective == OO_WORST) ? 2 : 3;
+
+	long lb = lower_bound(p, n), cost;
+	int guess;
+	if (memo_lookup(p, set, n, &cost, &guess)) {
+		if (guess >= 0)
+			return cost;
+		if (cost > lb)
+			lb = cost;
+	}
+
+	if (lb >= beta)
+		return lb;
+
+	int *cands;
+	int num_cands = rank_guesses(p, set, n, &cands);
+	if (num_cands < 0)
+		return -1;
+
+	long best = beta;
+	int best_guess = -1;
+	for (int i = 0; i < num_cands; ++i) {
+		long cost = eval_guess(p, set, n, cands[i], best);
+		if (cost < 0) {
+			free(cands);
+			return -1;
+		}
+
+		if (cost < best) {
+			best = cost;
+			best_guess = cands[i];
+			if (best <= lb)
+				break;
+		}
+	}
+
+	free(cands);
+
+	if (best_guess >= 0)
+		memo_store(p, set, n, best, p->guesses[best_guess]);
+	else
+		memo_store(p, set, n, beta, -1);
+
+	return best;
+}
+
+/* The root guesses are tried in parallel. The best one so far is kept
+ * as cost * num_cands + rank, so that of guesses with equal costs the
+ * best ranked wins, as it would in a sequential search. */
+typedef struct {
+	const Problem *p;
+	const int *set;
+	int n, guess;
+	long rank, num_cands;
+	_Atomic long *best_key;
+	bool failed;
+} RootTask;
+
+static void
+root_worker(void *info)
+{
+	RootTask *task = info;
+
+	long key = atomic_load(task->best_key);
+	long beta = (key - task->rank + task->num_cands - 1) / task->num_cands;
+
+	long cost = eval_guess(task->p, task->set, task->n, task->guess, beta);
+	task->failed = cost < 0;
+	if (cost < 0 || cost >= beta)
+		return;
+
+	long new_key = cost * task->num_cands + task->rank;
+	while (new_key < key && !atomic_compare_exchange_weak(task->best_key, &key, new_key))
+		;
+}
+
+static int
+compare_ints(const void *a, const void *b)
+{
+	return *(const int *)a - *(const int *)b;
+}
+
+static int
+make_problem(Problem *p, const Game *g, int *targets, int n)
+{
+	Dict *d = g->dict;
+
+	memset(p, 0, sizeof(*p));
+	p->g = g;
+	p->memo = d->optimal;
+	p->settings = g->optimal_width << 2 | g->suggest_slurs << 1 | (g->optimal_objective == OO_WORST);
+	p->targets = targets;
+	p->num_targets = n;
+
+	p->guesses = malloc(sizeof(int) * (d->num_words + 1));
+	if (p->guesses == NULL)
+		return -1;
+
+	for (int i = 0; i < d->num_words; ++i)
+		if (g->suggest_slurs || !(d->attrs[i].flags & WA_SLUR))
+			p->guesses[p->num_guesses++] = i;
+
+	p->codes = malloc((size_t)p->num_guesses * n);
+	if (p->codes == NULL)
+		return -1;
+
+	bool matrix = use_pattern_matrix(d, (long)p->num_guesses * n) == 0;
+	for (int j = 0; matrix && j < n; ++j)
+		matrix = d->pattern_cols[targets[j]] >= 0;
+
+	if (matrix) {
+		for (int g = 0; g < p->num_guesses; ++g) {
+			uint8_t *codes = p->codes + (size_t)g * n;
+			const uint8_t *row = pattern_row(d, p->guesses[g]);
+			for (int j = 0; j < n; ++j)
+				codes[j] = row[d->pattern_cols[targets[j]]];
+		}
+
+		return 0;
+	}
+
+	/* one guess against all targets at a time */
+	WordPlanes planes = { 0 };
+	int rc = planes_gather(&planes, d->words, targets, n);
+
+	uint8_t *block = (rc == 0) ? malloc(planes.capacity) : NULL;
+	for (int g = 0; block != NULL && g < p->num_guesses; ++g) {
+		planes_patterns(block, &planes, &d->words[p->guesses[g]], 0, planes_blocks(&planes));
+		memcpy(p->codes + (size_t)g * n, block, n);
+	}
+
+	if (block == NULL)
+		rc = -1;
+
+	free(block);
+	planes_free(&planes);
+	return rc;
+}
+
+long
+optimal_guess(const Game *g, const int *targets, int num_targets, int *guess_out)
+{
+	if (num_targets <= 0 || g->dict->attrs == NULL || g->dict->optimal == NULL)
+		return -1;
+
+	if (num_targets <= 2) {
+		*guess_out = targets[0];
+		if (g->optimal_objective == OO_WORST)
+			return num_targets;
+		return 2L * num_targets - 1;
+	}
+
+	int *sorted = malloc(sizeof(int) * num_targets);
+	int *set = malloc(sizeof(int) * num_targets);
+	if (sorted == NULL || set == NULL) {
+		fprintf(stderr, "out of memory\n");
+		free(sorted);
+		free(set);
+		return -1;
+	}
+
+	memcpy(sorted, targets, sizeof(int) * num_targets);
+	qsort(sorted, num_targets, sizeof(int), compare_ints);
+	for (int j = 0; j < num_targets; ++j)
+		set[j] = j;
+
+	long cost = -1;
+	int *cands = NULL;
+	RootTask *tasks = NULL;
+
+	Problem p;
+	if (make_problem(&p, g, sorted, num_targets) < 0)
+		goto oom;
+
+	int guess;
+	if (memo_lookup(&p, set, num_targets, &cost, &guess) && guess >= 0) {
+		*guess_out = guess;
+		goto done;
+	}
+
+	int num_cands = rank_guesses(&p, set, num_targets, &cands);
+	if (num_cands < 0)
+		goto oom;
+
+	tasks = malloc(sizeof(RootTask) * (num_cands + 1));
+	if (tasks == NULL)
+		goto oom;
+
+	long none = (LONG_MAX / 4 / (num_cands + 1)) * (num_cands + 1);
+	_Atomic long best_key = none;
+	for (int i = 0; i < num_cands; ++i) {
+		tasks[i].p = &p;
+		tasks[i].set = set;
+		tasks[i].n = num_targets;
+		tasks[i].guess = cands[i];
+		tasks[i].rank = i;
+		tasks[i].num_cands = num_cands + 1;
+		tasks[i].best_key = &best_key;
+		tasks[i].failed = false;
+	}
+
+	threadpool_run(score_pool(), root_worker, tasks, num_cands, sizeof(tasks[0]));
+
+	/* a guess not searched through might have been the best */
+	for (int i = 0; i < num_cands; ++i)
+		if (tasks[i].failed)
+			goto oom;
+
+	long key = best_key;
+	if (key == none) {
+		fprintf(stderr, "error: no guess tells the targets apart\n");
+		cost = -1;
+		goto done;
+	}
+
+	cost = key / (num_cands + 1);
+	*guess_out = p.guesses[cands[key % (num_cands + 1)]];
+	memo_store(&p, set, num_targets, cost, *guess_out);
+	goto done;
+
+oom:
+	fprintf(stderr, "out of memory\n");
+	cost = -1;
+done:
+	free(tasks);
+	free(cands);
+	free(p.guesses);
+	free(p.codes);
+	free(set);
+	free(sorted);
+	return cost;
+}
+
+double
+optimal_guesses(const Game *g, Word *top, int max_out, int *num_out)
+{
+	if (g->num_opts <= 0 || max_out <= 0)
+		return -1.0;
+
+	int guess;
+	long cost = optimal_guess(g, g->opts, g->num_opts, &guess);
+	if (cost < 0)
+		return -1.0;
+
+	top[0] = g->dict->words[guess];
+	*num_out = 1;
+
+	if (g->optimal_objective == OO_WORST)
+		return cost;
+	return (double)cost / g->num_opts;
+}
@@ -0,0 +1,194 @@
+/*
+ * Tools for making educated word1e guesses.
+ * Copyright (C) 2023 Antonie Blom
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ * USA
+ */
+
+#ifndef _GNU_SOURCE
+#  define _GNU_SOURCE
+#endif
+
+#include <pattern.h>
+#include <planes.h>
+#include <score.h>
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ROWS_PER_TASK 64
+#define MAX_TASKS     1024
+
+/* Larger matrices aren't built; their patterns are always computed on
+ * the fly. */
+#define MAX_MATRIX_PAIRS (1L << 30)
+
+typedef struct {
+	int from, to;
+	const Word *words;
+	uint8_t *matrix;
+	const WordPlanes *cols; /* the target words */
+	uint8_t *codes;         /* planes_patterns output, padding included */
+} MatrixTask;
+
+static void
+build_rows(void *info)
+{
+	MatrixTask *task = info;
+	int num_cols = task->cols->count;
+
+	for (int i = task->from; i < task->to; ++i) {
+		planes_patterns(task->codes, task->cols, &task->words[i], 0, planes_blocks(task->cols));
+		memcpy(task->matrix + (size_t)i * num_cols, task->codes, num_cols);
+	}
+}
+
+static int
+build_locked(Dict *d)
+{
+	int num_words = d->num_words;
+	int *cols = malloc(sizeof(int) * num_words);
+	Word *col_words = malloc(sizeof(Word) * (num_words + 1));
+	uint8_t *matrix = NULL, *codes = NULL;
+	WordPlanes col_planes = { 0 };
+	if (cols == NULL || col_words == NULL)
+		goto oom;
+
+	int num_cols = 0;
+	for (int i = 0; i < num_words; ++i) {
+		cols[i] = -1;
+		if (d->attrs[i].flags & WA_TARGET) {
+			cols[i] = num_cols;
+			col_words[num_cols++] = d->words[i];
+		}
+	}
+
+	if (planes_load(&col_planes, col_words, num_cols) < 0)
+		goto fail;
+
+	MatrixTask tasks[MAX_TASKS];
+
+	int num_tasks = 1 + (num_words - 1) / ROWS_PER_TASK;
+	if (num_tasks > MAX_TASKS)
+		num_tasks = MAX_TASKS;
+
+	matrix = malloc((size_t)num_words * num_cols + 1);
+	codes = malloc((size_t)num_tasks * col_planes.capacity);
+	if (matrix == NULL || codes == NULL)
+		goto oom;
+
+	if (verbosity > 0)
+		fprintf(stderr, "building %d x %d pattern matrix...\n", num_words, num_cols);
+
+	for (int i = 0; i < num_tasks; ++i) {
+		tasks[i].from = i * num_words / num_tasks;
+		tasks[i].to = (i + 1) * num_words / num_tasks;
+		tasks[i].words = d->words;
+		tasks[i].matrix = matrix;
+		tasks[i].cols = &col_planes;
+		tasks[i].codes = codes + (size_t)i * col_planes.capacity;
+	}
+
+	threadpool_run(score_pool(), build_rows, tasks, num_tasks, sizeof(tasks[0]));
+	free(col_words);
+	free(codes);
+	planes_free(&col_planes);
+
+	d->pattern_cols = cols;
+	d->num_pattern_cols = num_cols;
+	d->pattern_matrix = matrix;
+	return 0;
+
+oom:
+	fprintf(stderr, "out of memory\n");
+fail:
+	free(cols);
+	free(col_words);
+	free(matrix);
+	free(codes);
+	planes_free(&col_planes);
+	return -1;
+}
+
+/* the number of entries of the matrix, that is its size in bytes */
+static long
+count_pairs(Dict *d)
+{
+	if (d->matrix_pairs == 0) {
+		for (int i = 0; i < d->num_words; ++i)
+			if (d->attrs[i].flags & WA_TARGET)
+				d->matrix_pairs += d->num_words;
+	}
+
+	return d->matrix_pairs;
+}
+
+int
+build_pattern_matrix(Dict *d)
+{
+	if (d->words == NULL || d->attrs == NULL)
+		return -1;
+
+	pthread_mutex_lock(&d->matrix_lock);
+
+	int rc = 0;
+	if (d->pattern_matrix == NULL)
+		rc = (count_pairs(d) > MAX_MATRIX_PAIRS) ? -1 : build_locked(d);
+
+	pthread_mutex_unlock(&d->matrix_lock);
+	return rc;
+}
+
+int
+use_pattern_matrix(Dict *d, long pairs)
+{
+	if (d->words == NULL || d->attrs == NULL)
+		return -1;
+
+	pthread_mutex_lock(&d->matrix_lock);
+
+	/* patterns are computed on the fly until that has cost about as
+	 * much as building the matrix would, so short-lived processes
+	 * don't pay for rows they never look at */
+	int rc = 0;
+	if (d->pattern_matrix == NULL) {
+		d->pairs_computed += pairs;
+		if (count_pairs(d) > MAX_MATRIX_PAIRS || d->pairs_computed < d->matrix_pairs)
+			rc = -1;
+		else
+			rc = build_locked(d);
+	}
+
+	pthread_mutex_unlock(&d->matrix_lock);
+	return rc;
+}
+
+void
+free_pattern_matrix(Dict *d)
+{
+	pthread_mutex_lock(&d->matrix_lock);
+
+	free(d->pattern_matrix);
+	free(d->pattern_cols);
+	d->pattern_matrix = NULL;
+	d->pattern_cols = NULL;
+	d->num_pattern_cols = 0;
+	d->pairs_computed = d->matrix_pairs = 0;
+
+	pthread_mutex_unlock(&d->matrix_lock);
+}
@@ -0,0 +1,427 @@
+/*
+ * Tools for making educated word1e guesses.
+ * Copyright (C) 2023 Antonie Blom
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ * USA
+ */
+
+#ifndef _GNU_SOURCE
+#  define _GNU_SOURCE
+#endif
+
+#include <planes.h>
+
+#include <immintrin.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Tests blocks [from, to) of 64 words each. */
+typedef void (*MatchKernel)(uint64_t *mask,
+                            const WordPlanes *p,
+                            const Know *know,
+                            int from,
+                            int to);
+
+static void
+match_scalar(uint64_t *mask, const WordPlanes *p, const Know *know, int from, int to)
+{
+	for (int b = from; b < to; ++b) {
+		uint64_t bits = 0;
+		for (int k = 0; k < 64; ++k) {
+			int w = b * 64 + k;
+
+			uint32_t bad = 0;
+			for (int i = 0; i < 5; ++i)
+				bad |= know->exclude[i] >> p->letters[i][w];
+
+			bool ok = (bad & 1) == 0
+			       && (p->hist[0][w] & know->hist[0]) == know->hist[0]
+			       && (p->hist[1][w] & know->hist[1]) == know->hist[1];
+
+			bits |= (uint64_t)ok << k;
+		}
+
+		mask[b - from] = bits;
+	}
+}
+
+/* Byte i of the table is 0xff iff letter i is excluded. */
+static void
+exclude_table(uint8_t table[32], uint32_t exclude)
+{
+	for (int i = 0; i < 32; ++i)
+		table[i] = (exclude >> i) & 1 ? 0xff : 0x00;
+}
+
+__attribute__((target("avx2")))
+static void
+match_avx2(uint64_t *mask, const WordPlanes *p, const Know *know, int from, int to)
+{
+	__m256i lo[5], hi[5];
+	for (int i = 0; i < 5; ++i) {
+		uint8_t table[32];
+		exclude_table(table, know->exclude[i]);
+		lo[i] = _mm256_broadcastsi128_si256(_mm_loadu_si128((void *)table));
+		hi[i] = _mm256_broadcastsi128_si256(_mm_loadu_si128((void *)(table + 16)));
+	}
+
+	__m256i fifteen = _mm256_set1_epi8(15);
+	__m256i k0 = _mm256_set1_epi64x(know->hist[0]);
+	__m256i k1 = _mm256_set1_epi64x(know->hist[1]);
+
+	for (int b = from; b < to; ++b) {
+		uint64_t bits = 0;
+		for (int half = 0; half < 2; ++half) {
+			int base = b * 64 + half * 32;
+
+			__m256i bad = _mm256_setzero_si256();
+			for (int i = 0; i < 5; ++i) {
+				__m256i v = _mm256_loadu_si256((void *)(p->letters[i] + base));
+				__m256i l = _mm256_shuffle_epi8(lo[i], v);
+				__m256i h = _mm256_shuffle_epi8(hi[i], v);
+				__m256i sel = _mm256_cmpgt_epi8(v, fifteen);
+				bad = _mm256_or_si256(bad, _mm256_blendv_epi8(l, h, sel));
+			}
+
+			uint32_t ok = ~(uint32_t)_mm256_movemask_epi8(bad);
+
+			uint32_t hist_ok = 0;
+			for (int k = 0; k < 32; k += 4) {
+				__m256i h0 = _mm256_loadu_si256((void *)(p->hist[0] + base + k));
+				__m256i h1 = _mm256_loadu_si256((void *)(p->hist[1] + base + k));
+				__m256i t0 = _mm256_cmpeq_epi64(_mm256_and_si256(h0, k0), k0);
+				__m256i t1 = _mm256_cmpeq_epi64(_mm256_and_si256(h1, k1), k1);
+				__m256d t = _mm256_castsi256_pd(_mm256_and_si256(t0, t1));
+				hist_ok |= (uint32_t)_mm256_movemask_pd(t) << k;
+			}
+
+			bits |= (uint64_t)(ok & hist_ok) << (half * 32);
+		}
+
+		mask[b - from] = bits;
+	}
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void
+match_avx512(uint64_t *mask, const WordPlanes *p, const Know *know, int from, int to)
+{
+	__m512i lo[5], hi[5];
+	for (int i = 0; i < 5; ++i) {
+		uint8_t table[32];
+		exclude_table(table, know->exclude[i]);
+		lo[i] = _mm512_broadcast_i32x4(_mm_loadu_si128((void *)table));
+		hi[i] = _mm512_broadcast_i32x4(_mm_loadu_si128((void *)(table + 16)));
+	}
+
+	__m512i fifteen = _mm512_set1_epi8(15);
+	__m512i k0 = _mm512_set1_epi64(know->hist[0]);
+	__m512i k1 = _mm512_set1_epi64(know->hist[1]);
+
+	for (int b = from; b < to; ++b) {
+		int base = b * 64;
+
+		__mmask64 bad = 0;
+		for (int i = 0; i < 5; ++i) {
+			__m512i v = _mm512_loadu_si512(p->letters[i] + base);
+			__m512i l = _mm512_shuffle_epi8(lo[i], v);
+			__m512i h = _mm512_shuffle_epi8(hi[i], v);
+			__mmask64 sel = _mm512_cmpgt_epi8_mask(v, fifteen);
+			__m512i t = _mm512_mask_blend_epi8(sel, l, h);
+			bad |= _mm512_test_epi8_mask(t, t);
+		}
+
+		uint64_t hist_ok = 0;
+		for (int k = 0; k < 64; k += 8) {
+			__m512i h0 = _mm512_loadu_si512(p->hist[0] + base + k);
+			__m512i h1 = _mm512_loadu_si512(p->hist[1] + base + k);
+			__mmask8 t0 = _mm512_cmpeq_epi64_mask(_mm512_and_si512(h0, k0), k0);
+			__mmask8 t1 = _mm512_cmpeq_epi64_mask(_mm512_and_si512(h1, k1), k1);
+			hist_ok |= (uint64_t)(t0 & t1) << k;
+		}
+
+		mask[b - from] = ~bad & hist_ok;
+	}
+}
+
+static MatchKernel
+match_kernel(void)
+{
+	static MatchKernel kernel;
+	if (kernel != NULL)
+		return kernel;
+
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512bw"))
+		kernel = match_avx512;
+	else if (__builtin_cpu_supports("avx2"))
+		kernel = match_avx2;
+	else
+		kernel = match_scalar;
+
+	return kernel;
+}
+
+/* Pattern codes of guess against the words of blocks [from, to).
+ * Without branches: a guess letter that isn't green is yellow iff
+ * fewer of its copies earlier in the guess aren't green than there
+ * are copies of it in the target that aren't green. */
+typedef void (*PatternKernel)(uint8_t *codes,
+                              const WordPlanes *p,
+                              const Word *guess,
+                              int from,
+                              int to);
+
+static const uint8_t powers_of_3[5] = { 1, 3, 9, 27, 81 };
+
+static void
+patterns_scalar(uint8_t *codes, const WordPlanes *p, const Word *guess, int from, int to)
+{
+	for (int w = from * 64; w < to * 64; ++w) {
+		Word target = { 0 };
+		for (int i = 0; i < 5; ++i)
+			word_set_letter(&target, i, 'A' + p->letters[i][w]);
+
+		codes[w - from * 64] = word_pattern(guess, &target);
+	}
+}
+
+__attribute__((target("avx2")))
+static void
+patterns_avx2(uint8_t *codes, const WordPlanes *p, const Word *guess, int from, int to)
+{
+	__m256i g[5];
+	for (int i = 0; i < 5; ++i)
+		g[i] = _mm256_set1_epi8(word_code(guess, i));
+
+	for (int w = from * 64; w < to * 64; w += 32) {
+		__m256i t[5], not_green[5];
+		for (int i = 0; i < 5; ++i) {
+			t[i] = _mm256_loadu_si256((void *)(p->letters[i] + w));
+			not_green[i] = _mm256_xor_si256(_mm256_cmpeq_epi8(t[i], g[i]), _mm256_set1_epi8(-1));
+		}
+
+		__m256i code = _mm256_setzero_si256();
+		for (int i = 0; i < 5; ++i) {
+			/* counts go up by subtracting the all-ones masks */
+			__m256i avail = _mm256_setzero_si256(), rank = _mm256_setzero_si256();
+			for (int j = 0; j < 5; ++j)
+				avail = _mm256_sub_epi8(avail, _mm256_and_si256(not_green[j], _mm256_cmpeq_epi8(t[j], g[i])));
+			for (int j = 0; j < i; ++j)
+				if (word_code(guess, j) == word_code(guess, i))
+					rank = _mm256_sub_epi8(rank, not_green[j]);
+
+			__m256i yellow = _mm256_and_si256(not_green[i], _mm256_cmpgt_epi8(avail, rank));
+			code = _mm256_add_epi8(code, _mm256_andnot_si256(not_green[i], _mm256_set1_epi8(powers_of_3[i])));
+			code = _mm256_add_epi8(code, _mm256_and_si256(yellow, _mm256_set1_epi8(2 * powers_of_3[i])));
+		}
+
+		_mm256_storeu_si256((void *)(codes + w - from * 64), code);
+	}
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void
+patterns_avx512(uint8_t *codes, const WordPlanes *p, const Word *guess, int from, int to)
+{
+	__m512i g[5];
+	for (int i = 0; i < 5; ++i)
+		g[i] = _mm512_set1_epi8(word_code(guess, i));
+
+	__m512i one = _mm512_set1_epi8(1);
+	for (int b = from; b < to; ++b) {
+		int base = b * 64;
+
+		__m512i t[5];
+		__mmask64 not_green[5];
+		for (int i = 0; i < 5; ++i) {
+			t[i] = _mm512_loadu_si512(p->letters[i] + base);
+			not_green[i] = _mm512_cmpneq_epi8_mask(t[i], g[i]);
+		}
+
+		__m512i code = _mm512_setzero_si512();
+		for (int i = 0; i < 5; ++i) {
+			__m512i avail = _mm512_setzero_si512(), rank = _mm512_setzero_si512();
+			for (int j = 0; j < 5; ++j)
+				avail = _mm512_mask_add_epi8(avail, not_green[j] & _mm512_cmpeq_epi8_mask(t[j], g[i]), avail, one);
+			for (int j = 0; j < i; ++j)
+				if (word_code(guess, j) == word_code(guess, i))
+					rank = _mm512_mask_add_epi8(rank, not_green[j], rank, one);
+
+			__mmask64 yellow = not_green[i] & _mm512_cmpgt_epi8_mask(avail, rank);
+			code = _mm512_mask_add_epi8(code, ~not_green[i], code, _mm512_set1_epi8(powers_of_3[i]));
+			code = _mm512_mask_add_epi8(code, yellow, code, _mm512_set1_epi8(2 * powers_of_3[i]));
+		}
+
+		_mm512_storeu_si512(codes + base - from * 64, code);
+	}
+}
+
+static PatternKernel
+pattern_kernel(void)
+{
+	static PatternKernel kernel;
+	if (kernel != NULL)
+		return kernel;
+
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512bw"))
+		kernel = patterns_avx512;
+	else if (__builtin_cpu_supports("avx2"))
+		kernel = patterns_avx2;
+	else
+		kernel = patterns_scalar;
+
+	return kernel;
+}
+
+void
+planes_patterns(uint8_t *codes, const WordPlanes *p, const Word *guess, int from, int to)
+{
+	pattern_kernel()(codes, p, guess, from, to);
+}
+
+static uint64_t
+tail_mask(const WordPlanes *p, int block)
+{
+	int left = p->count - block * 64;
+	return (left >= 64) ? ~(uint64_t)0 : ((uint64_t)1 << left) - 1;
+}
+
+void
+planes_match(uint64_t *mask, const WordPlanes *p, const Know *know)
+{
+	int blocks = planes_blocks(p);
+	if (blocks == 0)
+		return;
+
+	match_kernel()(mask, p, know, 0, blocks);
+	mask[blocks - 1] &= tail_mask(p, blocks - 1);
+}
+
+int
+planes_count(const WordPlanes *p, const Know *know)
+{
+	MatchKernel kernel = match_kernel();
+	int blocks = planes_blocks(p);
+
+	int count = 0;
+	for (int b = 0; b < blocks; b += 64) {
+		uint64_t mask[64];
+		int to = (b + 64 < blocks) ? b + 64 : blocks;
+		kernel(mask, p, know, b, to);
+
+		mask[to - b - 1] &= tail_mask(p, to - 1);
+		for (int i = 0; i < to - b; ++i)
+			count += __builtin_popcountll(mask[i]);
+	}
+
+	return count;
+}
+
+void
+planes_free(WordPlanes *p)
+{
+	for (int i = 0; i < 5; ++i)
+		free(p->letters[i]);
+	free(p->hist[0]);
+	free(p->hist[1]);
+	memset(p, 0, sizeof(*p));
+}
+
+static int
+fill_planes(WordPlanes *p, const Word *words, const int *ids, int count)
+{
+	int capacity = (count + 63) / 64 * 64;
+	if (capacity == 0)
+		capacity = 64;
+
+	if (capacity > p->capacity) {
+		planes_free(p);
+
+		for (int i = 0; i < 5; ++i)
+			p->letters[i] = aligned_alloc(64, capacity);
+		p->hist[0] = aligned_alloc(64, capacity * sizeof(uint64_t));
+		p->hist[1] = aligned_alloc(64, capacity * sizeof(uint64_t));
+
+		p->capacity = capacity;
+		for (int i = 0; i < 5; ++i)
+			if (p->letters[i] == NULL)
+				goto oom;
+		if (p->hist[0] == NULL || p->hist[1] == NULL)
+			goto oom;
+	}
+
+	for (int i = 0; i < 5; ++i)
+		memset(p->letters[i], 0, p->capacity);
+	memset(p->hist[0], 0, p->capacity * sizeof(uint64_t));
+	memset(p->hist[1], 0, p->capacity * sizeof(uint64_t));
+
+	for (int w = 0; w < count; ++w) {
+		const Word *word = &words[ids != NULL ? ids[w] : w];
+		Histogram hist;
+		word_hist(word, hist);
+		for (int i = 0; i < 5; ++i)
+			p->letters[i][w] = word_code(word, i);
+		p->hist[0][w] = hist[0];
+		p->hist[1][w] = hist[1];
+	}
+
+	p->count = count;
+	return 0;
+
+oom:
+	fprintf(stderr, "out of memory\n");
+	planes_free(p);
+	return -1;
+}
+
+int
+planes_load(WordPlanes *p, const Word *words, int count)
+{
+	return fill_planes(p, words, NULL, count);
+}
+
+int
+planes_gather(WordPlanes *p, const Word *words, const int *ids, int count)
+{
+	return fill_planes(p, words, ids, count);
+}
+
+void
+planes_compact(WordPlanes *p, const uint64_t *mask)
+{
+	int j = 0;
+	for (int w = 0; w < p->count; ++w) {
+		if (!(mask[w / 64] & ((uint64_t)1 << (w % 64))))
+			continue;
+
+		for (int i = 0; i < 5; ++i)
+			p->letters[i][j] = p->letters[i][w];
+		p->hist[0][j] = p->hist[0][w];
+		p->hist[1][j] = p->hist[1][w];
+		++j;
+	}
+
+	/* keep the padding past the last word zeroed */
+	for (int i = 0; i < 5; ++i)
+		memset(p->letters[i] + j, 0, p->count - j);
+	memset(p->hist[0] + j, 0, (p->count - j) * sizeof(uint64_t));
+	memset(p->hist[1] + j, 0, (p->count - j) * sizeof(uint64_t));
+
+	p->count = j;
+}
@@ -23,31 +23,78 @@
 #endif
 
 #include <word.h>
+#include <bitindex.h>
+#include <cache.h>
+#include <game.h>
+#include <pattern.h>
+#include <planes.h>
+#include <second.h>
 #include <score.h>
 #include <threadpool.h>
 
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <pthread.h>
+#include <stdatomic.h>
 
 #include <sched.h>
 
 #define MIN_WORK_SIZE 128
 #define MAX_TASKS     256
 
+#define PARTITION_CODES 4096 /* patterns partition_score keeps */
+
+/* More than the rounding error of any score, less than the difference
+ * between any two scores that aren't equal. */
+#define SCORE_SLACK 1e-9
+
+#define POOL_QUEUE_SIZE 1024
+
+static const char *const metric_names[NUM_METRICS] = {
+	[MT_SQUARES]    = "squares",
+	[MT_ENTROPY]    = "entropy",
+	[MT_EXPECTED]   = "expected",
+	[MT_MAX_BUCKET] = "max",
+	[MT_BUCKETS]    = "buckets",
+};
+
+const char *
+score_metric_name(enum score_metric metric)
+{
+	return metric_names[metric];
+}
+
 int
-count_opts(const Know *know)
+score_metric_from_name(const char *name)
 {
+	for (int i = 0; i < NUM_METRICS; ++i)
+		if (0 == strcmp(name, metric_names[i]))
+			return i;
+
+	return -1;
+}
+
+int
+count_opts(const Game *g, const Know *know)
+{
+	if (g->opt_index.sets != NULL && g->opt_index.alive_count == g->num_opts)
+		return bitindex_count(&g->opt_index, know);
+
+	if (g->opt_planes.count == g->num_opts)
+		return planes_count(&g->opt_planes, know);
+
 	int res = 0;
-	for (int i = 0; i < num_opts; ++i)
-		if (word_matches(&opts[i], know))
+	for (int i = 0; i < g->num_opts; ++i)
+		if (word_matches(opt_word(g, i), know))
 			++res;
 
 	return res;
 }
 
-static int
+int
 cpu_count(void)
 {
 	cpu_set_t cs;
@@ -63,10 +110,185 @@ cpu_count(void)
 	return count;
 }
 
+static threadpool_t *pool;
+static pthread_once_t pool_once = PTHREAD_ONCE_INIT;
+
+static void
+destroy_pool(void)
+{
+	threadpool_destroy(pool, THREADPOOL_GRACEFUL);
+}
+
+static void
+create_pool(void)
+{
+	/* the thread running a batch works on it as well */
+	int threads = cpu_count() - 1;
+	if (threads <= 0)
+		return;
+
+	pool = threadpool_create(threads, POOL_QUEUE_SIZE, 0);
+	if (pool != NULL)
+		atexit(destroy_pool);
+}
+
+threadpool_t *
+score_pool(void)
+{
+	pthread_once(&pool_once, create_pool);
+	return pool;
+}
+
+/* Column of each option in the pattern matrix, or NULL if the matrix
+ * can't (or shouldn't yet) be used for the current options. */
+static int *
+opt_columns(const Game *g, long pairs)
+{
+	if (use_pattern_matrix(g->dict, pairs) < 0)
+		return NULL;
+
+	int *cols = malloc(sizeof(int) * (g->num_opts + 1));
+	if (cols == NULL)
+		return NULL;
+
+	for (int j = 0; j < g->num_opts; ++j) {
+		cols[j] = g->dict->pattern_cols[g->opts[j]];
+		if (cols[j] < 0) {
+			free(cols);
+			return NULL;
+		}
+	}
+
+	return cols;
+}
+
+void
+score_stats_reset(ScoreStats *st)
+{
+	memset(st, 0, sizeof(*st));
+}
+
+double
+score_stats_break_depth(const ScoreStats *st)
+{
+	return st->breaks ? (double)st->break_targets / st->breaks : 0.0;
+}
+
+double
+score_stats_imbalance(const ScoreStats *st)
+{
+	return st->task_mean_ns ? (double)st->task_max_ns / st->task_mean_ns : 1.0;
+}
+
+void
+score_stats_print(const ScoreStats *st, FILE *f)
+{
+	fprintf(f, "scored %ld guesses against %ld options\n", (long)st->guesses, (long)st->targets);
+	fprintf(f, "cut %ld short, after %.1f options on average\n",
+	        (long)st->breaks, score_stats_break_depth(st));
+	fprintf(f, "best_guesses: %ld calls, %ld searches\n", (long)st->calls, (long)st->searches);
+	fprintf(f, "phases: shortcut %.3f ms, candidates %.3f ms, scoring %.3f ms, merge %.3f ms\n",
+	        st->shortcut_ns / 1e6, st->candidates_ns / 1e6, st->scoring_ns / 1e6, st->merge_ns / 1e6);
+	fprintf(f, "task imbalance %.2f\n", score_stats_imbalance(st));
+}
+
+static inline void
+count_add(_Atomic long *counter, long n)
+{
+	atomic_fetch_add_explicit(counter, n, memory_order_relaxed);
+}
+
+/* Counts a guess compared with evaluated options. */
+static inline void
+count_scored(const Game *g, int evaluated, bool cut_short)
+{
+	ScoreStats *st = g->stats;
+	if (st == NULL)
+		return;
+
+	count_add(&st->guesses, 1);
+	count_add(&st->targets, evaluated);
+	if (cut_short) {
+		count_add(&st->breaks, 1);
+		count_add(&st->break_targets, evaluated);
+	}
+}
+
+/* Monotonic time in ns, if g collects stats. */
+static long
+stats_clock(const Game *g)
+{
+	if (g->stats == NULL)
+		return 0;
+
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+static inline uint8_t
+target_pattern(const Game *g, const Word *guess, const uint8_t *row, const int *cols, int j)
+{
+	if (row != NULL)
+		return row[cols[j]];
+	else
+		return word_pattern(guess, opt_word(g, j));
+}
+
+/* What playing guess in knowledge know leads to for each feedback,
+ * filled in as the feedback comes up: every target that gives the
+ * same pattern gives the same knowledge, and leaves the same number
+ * of options. */
+typedef struct {
+	Know know;
+	int opts;
+} KnowEntry;
+
+typedef struct {
+	const Game *g;
+	const Word *guess;
+	const Know *know;
+	uint64_t filled[(NUM_PATTERNS + 63) / 64];
+	KnowEntry entries[NUM_PATTERNS];
+} KnowTable;
+
+static void
+know_table_init(KnowTable *t, const Game *g, const Word *guess, const Know *know)
+{
+	t->g = g;
+	t->guess = guess;
+	t->know = know;
+	memset(t->filled, 0, sizeof(t->filled));
+}
+
+static inline const KnowEntry *
+know_table_get(KnowTable *t, uint8_t p)
+{
+	KnowEntry *e = &t->entries[p];
+	if (t->filled[p / 64] & ((uint64_t)1 << (p % 64)))
+		return e;
+
+	WordColor wc;
+	pattern_colors(wc, p);
+
+	Know new;
+	knowledge_from_colors(&new, t->guess, wc);
+
+	e->know = *t->know;
+	absorb_knowledge(&e->know, &new);
+	e->opts = count_opts(t->g, &e->know);
+
+	t->filled[p / 64] |= (uint64_t)1 << (p % 64);
+	return e;
+}
+
 typedef struct {
 	int from, to;
+	const Game *g;
 	const Know *know;
 	const Word *guess;
+	const uint8_t *row;
+	const int *cols;
 	double score_part;
 } ScoreTask;
 
@@ -75,57 +297,334 @@ score_guess_worker(void *info)
 {
 	ScoreTask *st = info;
 
-	Know know = *st->know;
+	const Game *g = st->g;
 	const Word *guess = st->guess;
 
+	KnowTable table;
+	know_table_init(&table, g, guess, st->know);
+
 	double score_part = 0.0;
-	double norm = (1.0 / num_opts) * (1.0 / num_opts);
+	double norm = (1.0 / g->num_opts) * (1.0 / g->num_opts);
 
 	int from = st->from, to = st->to;
 	for (int j = from; j < to; ++j) {
+		uint8_t p = target_pattern(g, guess, st->row, st->cols, j);
+		score_part -= know_table_get(&table, p)->opts * norm;
+	}
+
+	st->score_part = score_part;
+}
+
+static double
+simulate_score(const Game *g,
+               const Word *guess,
+               const uint8_t *row,
+               const int *cols,
+               bool may_hit,
+               const Know *know,
+               double break_at)
+{
+	double guess_score = 1.0;
+	double norm = (1.0 / g->num_opts) * (1.0 / g->num_opts);
+
+	if (may_hit)
+		guess_score += norm;
+
+	KnowTable table;
+	know_table_init(&table, g, guess, know);
+
+	int j = 0;
+	while (j < g->num_opts) {
+		uint8_t p = target_pattern(g, guess, row, cols, j++);
+		guess_score -= know_table_get(&table, p)->opts * norm;
+
+		if (guess_score < break_at)
+			break;
+	}
+
+	count_scored(g, j, j < g->num_opts);
+	return guess_score;
+}
+
+/* Know can't express an upper bound on a letter count, so for patterns
+ * in which a letter is both yellow and dark, more options match the
+ * simulated knowledge than share the pattern. */
+static bool
+pattern_is_lossy(const Word *guess, const WordColor wc)
+{
+	for (int i = 0; i < 5; ++i) {
+		if (wc[i] != DARK_COLOR)
+			continue;
+
+		for (int j = 0; j < 5; ++j)
+			if (wc[j] == YELLOW_COLOR && word_code(guess, j) == word_code(guess, i))
+				return true;
+	}
+
+	return false;
+}
+
+/* Pattern of guess against option j, from the matrix row if there is
+ * one. Otherwise block holds the patterns of the block of 64 options
+ * j is in, computed when j is the first of them, so j has to go up
+ * from 0. */
+static inline uint8_t
+option_pattern(const Game *g, const Word *guess, const uint8_t *row, const int *cols, uint8_t *block, int j)
+{
+	if (row != NULL)
+		return row[cols[j]];
+
+	if (g->opt_planes.count != g->num_opts)
+		return word_pattern(guess, opt_word(g, j));
+
+	if (j % 64 == 0)
+		planes_patterns(block, &g->opt_planes, guess, j / 64, j / 64 + 1);
+	return block[j % 64];
+}
+
+/* Adds an option that gives pattern p to its bucket in sizes and
+ * returns what it adds to the sum of squared bucket sizes: every
+ * option in a bucket of size n counts n, so the sum grows by 2 * n + 1
+ * for each new member. sims[p]: options matching the knowledge of a
+ * lossy pattern p (0 if the pattern isn't lossy), which count
+ * instead. */
+static inline long
+add_option(const Game *g, int *sizes, int *sims, const Word *guess, const Know *know, uint8_t p)
+{
+	int n = sizes[p]++;
+	if (n == 0) {
+		sims[p] = 0;
+
 		WordColor wc;
-		compare_to_target(wc, guess, &opts[j]);
+		pattern_colors(wc, p);
 
-		Know new;
-		knowledge_from_colors(&new, guess, wc);
+		if (pattern_is_lossy(guess, wc)) {
+			Know new;
+			knowledge_from_colors(&new, guess, wc);
 
-		Know sim_know = know;
-		absorb_knowledge(&sim_know, &new);
+			Know sim_know = *know;
+			absorb_knowledge(&sim_know, &new);
+			sims[p] = count_opts(g, &sim_know);
+		}
+	}
+
+	return sims[p] ? sims[p] : 2 * n + 1;
+}
+
+/* guess_score less what every option counts, subtracted one at a time
+ * in option order as simulate_score does, so that both modes give the
+ * same scores to the last bit and rank near ties alike. codes holds
+ * the patterns of the first PARTITION_CODES options. */
+static double
+ordered_score(const Game *g,
+              const Word *guess,
+              const uint8_t *row,
+              const int *cols,
+              const uint8_t *codes,
+              const int *sizes,
+              const int *sims,
+              double guess_score,
+              double break_at)
+{
+	double norm = (1.0 / g->num_opts) * (1.0 / g->num_opts);
 
-		int sim_opts = count_opts(&sim_know);
-		score_part -= sim_opts * norm;
+	uint8_t block[64];
+	for (int j = 0; j < g->num_opts; ++j) {
+		uint8_t p = (j < PARTITION_CODES) ? codes[j] : option_pattern(g, guess, row, cols, block, j);
+		guess_score -= (sims[p] ? sims[p] : sizes[p]) * norm;
+
+		if (guess_score < break_at)
+			break;
 	}
 
-	st->score_part = score_part;
+	return guess_score;
+}
+
+static double
+partition_score(const Game *g,
+                const Word *guess,
+                const uint8_t *row,
+                const int *cols,
+                bool may_hit,
+                const Know *know,
+                double break_at)
+{
+	int sizes[NUM_PATTERNS] = { 0 };
+	int sims[NUM_PATTERNS];
+	uint8_t codes[PARTITION_CODES];
+
+	double guess_score = 1.0;
+	double norm = (1.0 / g->num_opts) * (1.0 / g->num_opts);
+
+	if (may_hit)
+		guess_score += norm;
+
+	long sum = 0;
+	int j = 0;
+	uint8_t block[64];
+	while (j < g->num_opts) {
+		uint8_t p = option_pattern(g, guess, row, cols, block, j);
+		if (j < PARTITION_CODES)
+			codes[j] = p;
+		++j;
+		sum += add_option(g, sizes, sims, guess, know, p);
+
+		/* the exact sum only grows, so the score ends up below too */
+		if (guess_score - sum * norm < break_at - SCORE_SLACK) {
+			count_scored(g, j, true);
+			return guess_score - sum * norm;
+		}
+	}
+
+	count_scored(g, j, false);
+	return ordered_score(g, guess, row, cols, codes, sizes, sims, guess_score, break_at);
+}
+
+/* s * log2(s) in fixed point, so that sums of them don't depend on the
+ * order of the buckets and equal partitions get exactly equal entropy. */
+#define ENTROPY_ONE 4294967296.0
+
+static void
+partition_metrics(const Game *g,
+                  ScoreMetrics *m,
+                  const Word *guess,
+                  const uint8_t *row,
+                  const int *cols,
+                  bool may_hit,
+                  const Know *know)
+{
+	int num_opts = g->num_opts;
+	int sizes[NUM_PATTERNS] = { 0 };
+	int sims[NUM_PATTERNS];
+	uint8_t codes[PARTITION_CODES];
+
+	uint8_t block[64];
+	for (int j = 0; j < num_opts; ++j) {
+		uint8_t p = option_pattern(g, guess, row, cols, block, j);
+		if (j < PARTITION_CODES)
+			codes[j] = p;
+		add_option(g, sizes, sims, guess, know, p);
+	}
+
+	count_scored(g, num_opts, false);
+
+	long squares = 0;
+	int64_t slogs = 0;
+	m->max_bucket = 0;
+	m->buckets = 0;
+	for (int p = 0; p < NUM_PATTERNS; ++p) {
+		long s = sizes[p];
+		if (s == 0)
+			continue;
+
+		++m->buckets;
+		squares += s * s;
+		slogs += llround(s * log2(s) * ENTROPY_ONE);
+		if (s > m->max_bucket)
+			m->max_bucket = s;
+	}
+
+	double guess_score = 1.0;
+	double norm = (1.0 / num_opts) * (1.0 / num_opts);
+	if (may_hit)
+		guess_score += norm;
+
+	m->squares = ordered_score(g, guess, row, cols, codes, sizes, sims, guess_score, -INFINITY);
+	m->entropy = log2(num_opts) - slogs / ENTROPY_ONE / num_opts;
+	m->expected = (double)(squares - sizes[ALL_GREEN_PATTERN]) / num_opts;
 }
 
 double
-score_guess_with_attr(const Word *guess, const WordAttr *attr, const Know *know)
+metric_score(const ScoreMetrics *m, enum score_metric metric)
+{
+	switch (metric) {
+	case MT_ENTROPY:
+		return m->entropy;
+	case MT_EXPECTED:
+		return -m->expected;
+	case MT_MAX_BUCKET:
+		return -m->max_bucket;
+	case MT_BUCKETS:
+		return m->buckets;
+	default:
+		return m->squares;
+	}
+}
+
+static double
+score_guess_row(const Game *g,
+                const Word *guess,
+                const uint8_t *row,
+                const int *cols,
+                bool may_hit,
+                const Know *know,
+                double break_at)
 {
-	if (attr != NULL && has_no_knowledge(know))
-		return attr->starting_score;
+	if (g->score_metric != MT_SQUARES) {
+		ScoreMetrics m;
+		partition_metrics(g, &m, guess, row, cols, may_hit, know);
+		return metric_score(&m, g->score_metric);
+	}
+
+	if (g->score_mode == SM_PARTITION)
+		return partition_score(g, guess, row, cols, may_hit, know, break_at);
+
+	return simulate_score(g, guess, row, cols, may_hit, know, break_at);
+}
+
+/* whether guessing the word may end the game */
+static bool
+may_hit(const Word *guess, const WordAttr *attr, const Know *know)
+{
+	return (attr == NULL || (attr->flags & WA_TARGET)) && word_matches(guess, know);
+}
+
+double
+score_guess_with_attr(const Game *g, const Word *guess, const WordAttr *attr, const Know *know)
+{
+	if (attr != NULL && has_no_knowledge(know) && g->score_metric == MT_SQUARES)
+		return attr_score(attr);
 
 	ScoreTask tasks[MAX_TASKS];
+	int num_opts = g->num_opts;
+
+	const uint8_t *row = NULL;
+	int *cols = opt_columns(g, num_opts);
+	if (cols != NULL) {
+		int guess_idx = index_of_word(g->dict, guess);
+		if (guess_idx >= 0)
+			row = pattern_row(g->dict, guess_idx);
+	}
+
+	/* squares are summed over the same tasks in either mode, so that the
+	 * partial sums and thus the score stay the same to the last bit */
+	if (g->score_metric != MT_SQUARES) {
+		double score = score_guess_row(g, guess, row, cols, may_hit(guess, attr, know), know, -INFINITY);
+		free(cols);
+		return score;
+	}
 
 	int num_tasks = 1 + (num_opts - 1) / MIN_WORK_SIZE;
 	if (num_tasks > MAX_TASKS)
 		num_tasks = MAX_TASKS;
 
-	threadpool_t *pool = threadpool_create(cpu_count(), num_tasks, 0);
 	for (int i = 0; i < num_tasks; ++i) {
 		tasks[i].from = i * num_opts / num_tasks;
 		tasks[i].to = (i + 1) * num_opts / num_tasks;
+		tasks[i].g = g;
 		tasks[i].know = know;
 		tasks[i].guess = guess;
-
-		threadpool_add(pool, score_guess_worker, &tasks[i], 0);
+		tasks[i].row = row;
+		tasks[i].cols = cols;
 	}
 
-	threadpool_destroy(pool, THREADPOOL_GRACEFUL);
+	threadpool_run(score_pool(), score_guess_worker, tasks, num_tasks, sizeof(tasks[0]));
+	free(cols);
+	count_scored(g, num_opts, false);
 
 	double score = 1.0;
 
-	if ((attr == NULL || (attr->flags & WA_TARGET)) && word_matches(guess, know))
+	if (may_hit(guess, attr, know))
 		score += (1.0 / num_opts) * (1.0 / num_opts);
 
 	for (int i = 0; i < num_tasks; ++i)
@@ -135,141 +634,615 @@ score_guess_with_attr(const Word *guess, const WordAttr *attr, const Know *know)
 }
 
 double
-score_guess(const Word *guess, const Know *know)
+score_guess(const Game *g, const Word *guess, const Know *know)
+{
+	int i = index_of_word(g->dict, guess);
+	const WordAttr *attr = NULL;
+	if (i >= 0 && g->dict->attrs != NULL)
+		attr = &g->dict->attrs[i];
+	return score_guess_with_attr(g, guess, attr, know);
+}
+
+void
+score_guess_metrics(const Game *g, ScoreMetrics *m, const Word *guess, const Know *know)
 {
-	int i = index_of_word(guess);
+	int i = index_of_word(g->dict, guess);
 	const WordAttr *attr = NULL;
-	if (i >= 0 && word_attrs != NULL)
-		attr = &word_attrs[i];
-	return score_guess_with_attr(guess, attr, know);
+	if (i >= 0 && g->dict->attrs != NULL)
+		attr = &g->dict->attrs[i];
+
+	const uint8_t *row = NULL;
+	int *cols = opt_columns(g, g->num_opts);
+	if (cols != NULL && i >= 0)
+		row = pattern_row(g->dict, i);
+
+	partition_metrics(g, m, guess, row, cols, may_hit(guess, attr, know), know);
+	free(cols);
 }
 
 double
-score_guess_st(const Word *guess, const WordAttr *attr, const Know *know, double break_at)
+score_guess_st(const Game *g, const Word *guess, const WordAttr *attr, const Know *know, double break_at)
 {
-	double guess_score = 1.0;
+	return score_guess_row(g, guess, NULL, NULL, may_hit(guess, attr, know), know, break_at);
+}
+
+/* Per-position and overall letter counts of the options, used to bound
+ * the score of a guess without comparing it to every option. */
+typedef struct {
+	int num_opts;
+	enum score_metric metric;
+	int at[5][32];
+	int any[32];
+	uint32_t elsewhere[5]; /* letters of the options at other positions */
+} OptStats;
+
+static void
+opt_stats(OptStats *st, const Game *g)
+{
+	memset(st, 0, sizeof(*st));
+	st->num_opts = g->num_opts;
+	st->metric = g->score_metric;
+	for (int j = 0; j < g->num_opts; ++j) {
+		uint32_t seen = 0;
+		for (int i = 0; i < 5; ++i) {
+			int l = word_code(opt_word(g, j), i);
+			++st->at[i][l];
+			seen |= (uint32_t)1 << l;
+		}
+
+		for (; seen; seen &= seen - 1)
+			++st->any[__builtin_ctz(seen)];
+	}
+
+	for (int i = 0; i < 5; ++i)
+		for (int k = 0; k < 5; ++k)
+			for (int l = 0; k != i && l < 32; ++l)
+				if (st->at[k][l] > 0)
+					st->elsewhere[i] |= (uint32_t)1 << l;
+}
+
+/* Bound on the number of feedback patterns the guess can split the
+ * options into, from the colors each position can still take. */
+static int
+max_buckets(const Word *guess, const OptStats *st)
+{
+	int num_opts = st->num_opts;
+	int buckets = 1;
+	for (int i = 0; i < 5; ++i) {
+		int l = word_code(guess, i);
+		int green = st->at[i][l];
+
+		int colors = (green > 0);
+		if (green < num_opts)
+			colors += (st->elsewhere[i] >> l) & 1 ? 2 : 1;
+		buckets *= colors;
+	}
+
+	if (buckets > num_opts)
+		buckets = num_opts;
+	return buckets;
+}
+
+/* Upper bound on the score of a guess: every option in a bucket of m
+ * options counts at least m, and k buckets of n options in total sum
+ * to at least n^2 / k. */
+static double
+score_bound(int num_opts, int buckets, bool hit)
+{
+	long n = num_opts;
+	long sum = (n * n + buckets - 1) / buckets;
+
+	double score = 1.0;
 	double norm = (1.0 / num_opts) * (1.0 / num_opts);
+	if (hit)
+		score += norm;
 
-	if ((attr == NULL || (attr->flags & WA_TARGET)) && word_matches(guess, know))
-		guess_score += norm;
+	return score - sum * norm;
+}
 
-	for (int j = 0; j < num_opts; ++j) {
-		WordColor wc;
-		compare_to_target(wc, guess, &opts[j]);
+/* Upper bound on the score of a guess splitting the options into at
+ * most the given number of buckets, for any metric. */
+static double
+metric_bound(const OptStats *st, int buckets, bool hit)
+{
+	long n = st->num_opts;
 
-		Know new;
-		knowledge_from_colors(&new, guess, wc);
+	switch (st->metric) {
+	case MT_ENTROPY:
+		return log2(buckets);
+	case MT_EXPECTED:
+		return -(double)((n * n + buckets - 1) / buckets - 1) / n;
+	case MT_MAX_BUCKET:
+		return -((n + buckets - 1) / buckets);
+	case MT_BUCKETS:
+		return buckets;
+	default:
+		return score_bound(st->num_opts, buckets, hit);
+	}
+}
 
-		Know sim_know = *know;
-		absorb_knowledge(&sim_know, &new);
+/* How evenly the guess splits the options by letter, from 0 to 127;
+ * only used to try promising guesses first. */
+static int
+split_estimate(const Word *guess, const OptStats *st)
+{
+	int num_opts = st->num_opts;
+	int est = 0;
+	uint32_t seen = 0;
+	for (int i = 0; i < 5; ++i) {
+		int l = word_code(guess, i);
+		int g = st->at[i][l];
+		est += g < num_opts - g ? g : num_opts - g;
 
-		int sim_opts = count_opts(&sim_know);
-		guess_score -= sim_opts * norm;
+		if (seen & ((uint32_t)1 << l))
+			continue;
+		seen |= (uint32_t)1 << l;
 
-		if (guess_score < break_at)
-			break;
+		int a = st->any[l];
+		est += a < num_opts - a ? a : num_opts - a;
 	}
 
-	return guess_score;
+	return est * 127 / (5 * num_opts);
 }
 
 typedef struct {
-	pthread_mutex_t lock;
-	double best_score;
-	int num_out, max_out;
-	Word *top;
-} BestTaskOutput;
+	double bound;
+	int idx;
+	bool hit;
+	uint16_t key; /* by bound first, then by estimate */
+} Candidate;
 
+/* Radix sort on descending keys. It's stable, so candidates with equal
+ * keys stay in index order. */
+static void
+sort_candidates(Candidate *cands, Candidate *tmp, int count)
+{
+	for (int shift = 0; shift < 16; shift += 8) {
+		int start[257] = { 0 };
+		for (int i = 0; i < count; ++i)
+			++start[1 + (uint8_t)~(cands[i].key >> shift)];
+		for (int b = 0; b < 256; ++b)
+			start[b + 1] += start[b];
+		for (int i = 0; i < count; ++i)
+			tmp[start[(uint8_t)~(cands[i].key >> shift)]++] = cands[i];
+
+		Candidate *t = cands;
+		cands = tmp;
+		tmp = t;
+	}
+}
+
+/* Every task keeps its own list of the best guesses it has seen; the
+ * best score over all tasks is only shared to cut scoring short. */
 typedef struct {
 	int from, to;
-	BestTaskOutput *out;
+	const Game *g;
+	_Atomic double *best_score;
+	const Candidate *cands;
+	const int *cols;
 	Know know;
+
+	double local_best;
+	int num_local, max_local;
+	int *local;
+	long ns; /* time taken, if collecting stats */
 } BestTask;
 
 static void
-suggest(BestTaskOutput *out, int guess_idx, double guess_score)
+raise_best(_Atomic double *best_score, double score)
 {
-	if (!suggest_slurs && (word_attrs[guess_idx].flags & WA_SLUR))
-		return;
+	double cur = atomic_load_explicit(best_score, memory_order_relaxed);
+	while (score > cur && !atomic_compare_exchange_weak(best_score, &cur, score))
+		;
+}
 
-	if (guess_score > out->best_score) {
-		out->num_out = 0;
-		out->best_score = guess_score;
+static void
+suggest(BestTask *task, int guess_idx, double guess_score)
+{
+	if (guess_score > task->local_best) {
+		task->num_local = 0;
+		task->local_best = guess_score;
+		raise_best(task->best_score, guess_score);
 	}
 
-	if (out->num_out < out->max_out)
-		out->top[out->num_out] = all_words[guess_idx];
+	if (task->num_local == task->max_local) {
+		int max_local = task->max_local ? 2 * task->max_local : 16;
+		int *local = realloc(task->local, sizeof(int) * max_local);
+		if (local == NULL) {
+			fprintf(stderr, "out of memory\n");
+			return;
+		}
 
-	++out->num_out;
+		task->local = local;
+		task->max_local = max_local;
+	}
+
+	task->local[task->num_local++] = guess_idx;
 }
 
+/* Candidates come sorted by bound, so once one can't reach the best
+ * score, none of the remaining ones can. Scores only differ from the
+ * bound by rounding, so ties with the best score are never skipped. */
+
 static void
 best_guess_worker(void *info)
 {
 	BestTask *task = info;
-	BestTaskOutput *out = task->out;
-
-	double best_local_score = 0.0;
+	long start = stats_clock(task->g);
 
 	int from = task->from, to = task->to;
-	for (int i = from; i < to; ++i) {
-		double guess_score = score_guess_st(&all_words[i],
-		                                    &word_attrs[i],
-		                                    &task->know,
-		                                    best_local_score);
+	for (int c = from; c < to; ++c) {
+		const Candidate *cand = &task->cands[c];
+		int i = cand->idx;
+
+		double best = atomic_load_explicit(task->best_score, memory_order_relaxed);
+		if (best < task->local_best)
+			best = task->local_best;
 
-		pthread_mutex_lock(&out->lock);
-		if (guess_score >= out->best_score)
-			suggest(out, i, guess_score);
+		if (cand->bound + SCORE_SLACK < best)
+			break;
+
+		const Dict *d = task->g->dict;
+		const uint8_t *row = task->cols ? pattern_row(d, i) : NULL;
+		double guess_score = score_guess_row(task->g,
+		                                     &d->words[i],
+		                                     row,
+		                                     task->cols,
+		                                     cand->hit,
+		                                     &task->know,
+		                                     best);
 
-		best_local_score = out->best_score;
-		pthread_mutex_unlock(&out->lock);
+		if (guess_score >= best)
+			suggest(task, i, guess_score);
 	}
+
+	task->ns = stats_clock(task->g) - start;
 }
 
-double
-best_guesses(Word *top, int max_out, int *num_out, const Know *know)
+static int
+compare_ints(const void *a, const void *b)
 {
-	if (word_attrs != NULL && has_no_knowledge(know)) {
-		top[0] = all_words[0];
+	return *(const int *)a - *(const int *)b;
+}
+
+/* Ties are reported in index order, as a single thread would find them. */
+static double
+merge_best(const Game *g,
+           BestTask *tasks,
+           int num_tasks,
+           const Know *know,
+           Word *top,
+           int max_out,
+           int *num_out)
+{
+	double best_score = -INFINITY;
+	int n = 0;
+	for (int i = 0; i < num_tasks; ++i) {
+		if (tasks[i].num_local == 0 || tasks[i].local_best < best_score)
+			continue;
+
+		if (tasks[i].local_best > best_score)
+			n = 0;
+		best_score = tasks[i].local_best;
+		n += tasks[i].num_local;
+	}
+
+	int *ties = malloc(sizeof(int) * (n + 1));
+	if (ties == NULL) {
+		fprintf(stderr, "out of memory\n");
+		*num_out = 0;
+		return best_score;
+	}
+
+	int k = 0;
+	for (int i = 0; i < num_tasks; ++i) {
+		if (tasks[i].num_local == 0 || tasks[i].local_best != best_score)
+			continue;
+
+		memcpy(ties + k, tasks[i].local, sizeof(int) * tasks[i].num_local);
+		k += tasks[i].num_local;
+	}
+
+	qsort(ties, n, sizeof(int), compare_ints);
+	for (int i = 0; i < n && i < max_out; ++i)
+		top[i] = g->dict->words[ties[i]];
+
+	guess_cache_store(g, know, ties, n, n, best_score);
+
+	free(ties);
+	*num_out = n;
+	return best_score;
+}
+
+/* Answers know without scoring any guesses, if it can. */
+static bool
+best_shortcut(const Game *g, Word *top, int max_out, int *num_out, const Know *know, double *score)
+{
+	const Dict *d = g->dict;
+	int num_opts = g->num_opts;
+
+	/* the index is sorted by starting score */
+	if (d->attrs != NULL && has_no_knowledge(know) && g->score_metric == MT_SQUARES) {
+		top[0] = d->words[0];
 		*num_out = 1;
-		return word_attrs[0].starting_score;
+		*score = attr_score(&d->attrs[0]);
+		return true;
 	}
 
+	/* guessing an option is best whatever the metric says */
 	if (num_opts > 0 && num_opts <= 2) {
-		memcpy(&top[0], &opts[0], num_opts * sizeof(Word));
+		for (int i = 0; i < num_opts && i < max_out; ++i)
+			top[i] = *opt_word(g, i);
 		*num_out = num_opts;
-		return (5 - num_opts) * 0.25;
+		if (g->score_metric == MT_SQUARES) {
+			*score = (5 - num_opts) * 0.25;
+			return true;
+		}
+
+		ScoreMetrics m;
+		score_guess_metrics(g, &m, opt_word(g, 0), know);
+		*score = metric_score(&m, g->score_metric);
+		return true;
 	}
 
-	BestTaskOutput out = {
-		.best_score = 0.0,
-		.max_out = max_out,
-		.top = top,
-		.num_out = 0,
-	};
+	const SecondGuess *sg = find_second_guess(g, know);
+	if (sg != NULL && (sg->count == sg->num_out || sg->count >= max_out)) {
+		for (int i = 0; i < sg->count && i < max_out; ++i)
+			top[i] = d->words[sg->top[i]];
+		*num_out = sg->num_out;
+		*score = sg->score;
+		return true;
+	}
 
-	pthread_mutex_init(&out.lock, NULL);
+	return guess_cache_lookup(g, know, top, max_out, num_out, score);
+}
 
-	BestTask tasks[MAX_TASKS];
+/* A best_guesses call whose tasks are yet to run. */
+typedef struct {
+	const Game *g;
+	Know know;
+	_Atomic double best_score;
+	int *cols;
+	Candidate *cands;
+	BestTask *tasks;
+	int num_tasks;
+} BestSearch;
 
-	int num_tasks = 1 + (num_words - 1) / MIN_WORK_SIZE;
-	if (num_tasks > MAX_TASKS)
-		num_tasks = MAX_TASKS;
+static int
+num_best_tasks(int num_cands)
+{
+	int num_tasks = 1 + (num_cands - 1) / MIN_WORK_SIZE;
+	return (num_tasks > MAX_TASKS) ? MAX_TASKS : num_tasks;
+}
+
+/* Sets up s and writes its tasks to tasks, which must have room for
+ * num_best_tasks(num_words). Returns the number of tasks, or -1. */
+static int
+begin_search(BestSearch *s, const Game *g, const Know *know, BestTask *tasks)
+{
+	const Dict *d = g->dict;
+	int num_words = d->num_words;
+
+	s->know = *know;
+	s->best_score = -INFINITY;
+	s->tasks = tasks;
+	s->num_tasks = 0;
+	s->cols = opt_columns(g, (long)num_words * g->num_opts);
+
+	uint64_t *matches = malloc(sizeof(uint64_t) * (planes_blocks(&d->planes) + 1));
+	s->cands = malloc(sizeof(Candidate) * 2 * (num_words + 1));
+	if (matches == NULL || s->cands == NULL) {
+		fprintf(stderr, "out of memory\n");
+		free(matches);
+		free(s->cands);
+		free(s->cols);
+		s->cands = NULL;
+		s->cols = NULL;
+		return -1;
+	}
+
+	planes_match(matches, &d->planes, know);
+
+	OptStats st;
+	opt_stats(&st, g);
+
+	Candidate *cands = s->cands;
+	int num_cands = 0;
+	for (int i = 0; i < num_words; ++i) {
+		if (!g->suggest_slurs && (d->attrs[i].flags & WA_SLUR))
+			continue;
+
+		int buckets = max_buckets(&d->words[i], &st);
+
+		Candidate *cand = &cands[num_cands++];
+		cand->idx = i;
+		cand->hit = (d->attrs[i].flags & WA_TARGET)
+		         && (matches[i / 64] & ((uint64_t)1 << (i % 64)));
+		cand->bound = metric_bound(&st, buckets, cand->hit);
+		cand->key = (buckets - 1) << 8 | cand->hit << 7 | split_estimate(&d->words[i], &st);
+	}
+
+	free(matches);
+
+	/* two passes leave the result in cands */
+	sort_candidates(cands, cands + num_words, num_cands);
+
+	/* the pool claims tasks in order, so the most promising guesses
+	 * get scored first */
+	int num_tasks = num_best_tasks(num_cands);
 
-	threadpool_t *pool = threadpool_create(cpu_count(), num_tasks, 0);
 	for (int i = 0; i < num_tasks; ++i) {
-		tasks[i].from = i * num_words / num_tasks;
-		tasks[i].to = (i + 1) * num_words / num_tasks;
+		tasks[i].from = i * num_cands / num_tasks;
+		tasks[i].to = (i + 1) * num_cands / num_tasks;
+		tasks[i].g = g;
 		tasks[i].know = *know;
-		tasks[i].out = &out;
+		tasks[i].best_score = &s->best_score;
+		tasks[i].cands = cands;
+		tasks[i].cols = s->cols;
+		tasks[i].local_best = -INFINITY;
+		tasks[i].num_local = 0;
+		tasks[i].max_local = 0;
+		tasks[i].local = NULL;
+	}
+
+	s->g = g;
+	s->num_tasks = num_tasks;
+	return num_tasks;
+}
+
+static void
+free_search(BestSearch *s)
+{
+	for (int i = 0; i < s->num_tasks; ++i)
+		free(s->tasks[i].local);
+	free(s->cands);
+	free(s->cols);
+}
+
+/* Collects what the tasks of s found, once they have run. */
+static double
+end_search(BestSearch *s, Word *top, int max_out, int *num_out)
+{
+	ScoreStats *st = s->g->stats;
+	long start = stats_clock(s->g);
 
-		threadpool_add(pool, best_guess_worker, &tasks[i], 0);
+	double score = merge_best(s->g, s->tasks, s->num_tasks, &s->know, top, max_out, num_out);
+
+	if (st != NULL) {
+		long max = 0, sum = 0;
+		for (int i = 0; i < s->num_tasks; ++i) {
+			sum += s->tasks[i].ns;
+			if (s->tasks[i].ns > max)
+				max = s->tasks[i].ns;
+		}
+
+		count_add(&st->searches, 1);
+		count_add(&st->task_max_ns, max);
+		count_add(&st->task_mean_ns, sum / s->num_tasks);
+		count_add(&st->merge_ns, stats_clock(s->g) - start);
 	}
 
-	threadpool_destroy(pool, THREADPOOL_GRACEFUL);
-	pthread_mutex_destroy(&out.lock);
+	free_search(s);
+	return score;
+}
+
+/* Adds the time since *clock to the counter, and restarts it. */
+static void
+count_phase(const Game *g, _Atomic long *counter, long *clock)
+{
+	long now = stats_clock(g);
+	count_add(counter, now - *clock);
+	*clock = now;
+}
+
+double
+best_guesses(const Game *g, Word *top, int max_out, int *num_out, const Know *know)
+{
+	ScoreStats *st = g->stats;
+	long clock = stats_clock(g);
+	if (st != NULL)
+		count_add(&st->calls, 1);
+
+	double score;
+	bool done = best_shortcut(g, top, max_out, num_out, know, &score);
+	if (st != NULL)
+		count_phase(g, &st->shortcut_ns, &clock);
+	if (done)
+		return score;
+
+	BestSearch s;
+	BestTask tasks[MAX_TASKS];
+	if (begin_search(&s, g, know, tasks) < 0) {
+		*num_out = 0;
+		return 0.0;
+	}
+	if (st != NULL)
+		count_phase(g, &st->candidates_ns, &clock);
+
+	threadpool_run(score_pool(), best_guess_worker, tasks, s.num_tasks, sizeof(tasks[0]));
+	if (st != NULL)
+		count_phase(g, &st->scoring_ns, &clock);
+
+	return end_search(&s, top, max_out, num_out);
+}
+
+int
+best_guesses_batch(const Game *g,
+                   const Know *knows,
+                   int count,
+                   Word *top,
+                   int max_out,
+                   int *num_out,
+                   double *scores)
+{
+	if (count <= 0)
+		return 0;
+
+	int max_tasks = num_best_tasks(g->dict->num_words);
+
+	Game *games = calloc(count, sizeof(Game));
+	BestSearch *searches = calloc(count, sizeof(BestSearch));
+	BestTask *tasks = malloc(sizeof(BestTask) * count * max_tasks);
+	if (games == NULL || searches == NULL || tasks == NULL) {
+		fprintf(stderr, "out of memory\n");
+		free(games);
+		free(searches);
+		free(tasks);
+		return -1;
+	}
+
+	ScoreStats *st = g->stats;
+	long clock = stats_clock(g);
+	if (st != NULL)
+		count_add(&st->calls, count);
+
+	int rc = 0, num_games = 0, num_tasks = 0;
+	for (int i = 0; i < count; ++i) {
+		Word *out = top + (size_t)i * max_out;
+
+		if (game_init_from(&games[i], g, &knows[i]) < 0) {
+			rc = -1;
+			break;
+		}
+		++num_games;
+
+		/* answered without a search, which leaves searches[i].g NULL */
+		bool done = best_shortcut(&games[i], out, max_out, &num_out[i], &knows[i], &scores[i]);
+		if (st != NULL)
+			count_phase(g, &st->shortcut_ns, &clock);
+		if (done)
+			continue;
+
+		int n = begin_search(&searches[i], &games[i], &knows[i], tasks + num_tasks);
+		if (n < 0) {
+			rc = -1;
+			break;
+		}
+
+		num_tasks += n;
+		if (st != NULL)
+			count_phase(g, &st->candidates_ns, &clock);
+	}
+
+	/* one batch for everything, so the pool never runs dry between
+	 * states */
+	if (rc == 0)
+		threadpool_run(score_pool(), best_guess_worker, tasks, num_tasks, sizeof(tasks[0]));
+	if (st != NULL)
+		count_phase(g, &st->scoring_ns, &clock);
+
+	for (int i = 0; i < num_games; ++i) {
+		Word *out = top + (size_t)i * max_out;
+		if (searches[i].g != NULL && rc == 0)
+			scores[i] = end_search(&searches[i], out, max_out, &num_out[i]);
+		else if (searches[i].g != NULL)
+			free_search(&searches[i]);
+
+		game_free(&games[i]);
+	}
 
-	*num_out = out.num_out;
-	return out.best_score;
+	free(tasks);
+	free(searches);
+	free(games);
+	return rc;
 }
@@ -0,0 +1,313 @@
+/*
+ * Tools for making educated word1e guesses.
+ * Copyright (C) 2023 Antonie Blom
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ * USA
+ */
+
+#include <second.h>
+#include <game.h>
+#include <pattern.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+static const char color_chars[] = {
+	[DARK_COLOR]   = 'B',
+	[GREEN_COLOR]  = 'G',
+	[YELLOW_COLOR] = 'Y',
+};
+
+/* Knowledge after playing the first word and getting colors. */
+static void
+opener_know(const Dict *d, Know *know, WordColor colors)
+{
+	Know new;
+	knowledge_from_colors(&new, &d->words[0], colors);
+
+	memset(know, 0, sizeof(*know));
+	absorb_knowledge(know, &new);
+}
+
+static SecondGuess *
+add_second_guess(Dict *d)
+{
+	SecondGuess *new = realloc(d->second_guesses, sizeof(SecondGuess) * (d->num_second_guesses + 1));
+	if (new == NULL) {
+		fprintf(stderr, "out of memory\n");
+		return NULL;
+	}
+
+	d->second_guesses = new;
+	return &d->second_guesses[d->num_second_guesses++];
+}
+
+void
+free_second_guesses(Dict *d)
+{
+	for (int i = 0; i < d->num_second_guesses; ++i)
+		free(d->second_guesses[i].top);
+	free(d->second_guesses);
+
+	d->second_guesses = NULL;
+	d->num_second_guesses = 0;
+}
+
+int
+compute_second_guesses(Dict *d)
+{
+	free_second_guesses(d);
+	if (d->num_words == 0)
+		return 0;
+
+	Word *top = malloc(sizeof(Word) * d->num_words);
+	if (top == NULL) {
+		fprintf(stderr, "out of memory\n");
+		return -1;
+	}
+
+	Game g;
+	if (game_init(&g, d) < 0) {
+		free(top);
+		return -1;
+	}
+
+	SecondGuess *table = NULL;
+	int count = 0;
+
+	for (int p = 0; p < NUM_PATTERNS; ++p) {
+		WordColor wc;
+		pattern_colors(wc, p);
+		if (all_green(wc))
+			continue;
+
+		Know know;
+		opener_know(d, &know, wc);
+		if (reset_opts(&g, &know) < 0)
+			goto fail;
+		if (g.num_opts == 0)
+			continue;
+
+		SecondGuess sg = {
+			.pattern = p,
+			.know = know,
+			.opt_catalog = g.opt_catalog,
+			.num_opts = g.num_opts,
+		};
+		sg.score = best_guesses(&g, top, d->num_words, &sg.num_out, &know);
+		sg.count = (sg.num_out < SECOND_MAX_TOP) ? sg.num_out : SECOND_MAX_TOP;
+		sg.top = malloc(sizeof(int) * (sg.count + 1));
+		SecondGuess *new_table = realloc(table, sizeof(SecondGuess) * (count + 1));
+		if (sg.top == NULL || new_table == NULL) {
+			fprintf(stderr, "out of memory\n");
+			free(sg.top);
+			goto fail;
+		}
+
+		for (int i = 0; i < sg.count; ++i)
+			sg.top[i] = index_of_word(d, &top[i]);
+
+		table = new_table;
+		table[count++] = sg;
+
+		if (verbosity > 0)
+			fprintf(stderr, "second guesses [%3d / %3d]        \r", p + 1, NUM_PATTERNS);
+	}
+
+	free(top);
+	game_free(&g);
+
+	/* only now, so that best_guesses didn't look them up */
+	d->second_guesses = table;
+	d->num_second_guesses = count;
+	return 0;
+
+fail:
+	free(top);
+	game_free(&g);
+	for (int i = 0; i < count; ++i)
+		free(table[i].top);
+	free(table);
+	return -1;
+}
+
+int
+append_second_guess(Dict *d, int pattern, double score, int num_out, int count, int *top)
+{
+	SecondGuess *sg = add_second_guess(d);
+	if (sg == NULL) {
+		free(top);
+		return -1;
+	}
+
+	WordColor wc;
+	pattern_colors(wc, pattern);
+
+	sg->pattern = pattern;
+	opener_know(d, &sg->know, wc);
+	sg->score = score;
+	sg->num_out = num_out;
+	sg->count = count;
+	sg->top = top;
+	return 0;
+}
+
+int
+count_second_guess_opts(Dict *d)
+{
+	if (d->num_second_guesses == 0)
+		return 0;
+
+	Game g;
+	if (game_init(&g, d) < 0)
+		return -1;
+
+	for (int i = 0; i < d->num_second_guesses; ++i) {
+		SecondGuess *sg = &d->second_guesses[i];
+		sg->opt_catalog = g.opt_catalog;
+		sg->num_opts = count_opts(&g, &sg->know);
+		if (sg->num_opts > 0)
+			continue;
+
+		/* no targets left, so the game fell back to other words */
+		Game h;
+		if (game_init_from(&h, &g, &sg->know) < 0) {
+			game_free(&g);
+			return -1;
+		}
+
+		sg->opt_catalog = h.opt_catalog;
+		sg->num_opts = h.num_opts;
+		game_free(&h);
+	}
+
+	game_free(&g);
+	return 0;
+}
+
+static int
+read_second_guess(Dict *d, FILE *f, int line)
+{
+	char colors[6];
+	double score;
+	int num_out, count;
+	if (fscanf(f, "%5s %lf %d %d", colors, &score, &num_out, &count) != 4
+	 || count < 0 || count > num_out) {
+		fprintf(stderr, "error: malformed #SECOND on line %d\n", line);
+		return -1;
+	}
+
+	WordColor wc;
+	for (int i = 0; i < 5; ++i) {
+		const char *c = memchr(color_chars, colors[i], sizeof(color_chars));
+		if (colors[i] == '\0' || c == NULL) {
+			fprintf(stderr, "error: bad colors on line %d\n", line);
+			return -1;
+		}
+
+		wc[i] = c - color_chars;
+	}
+
+	int *top = malloc(sizeof(int) * (count + 1));
+	if (top == NULL) {
+		fprintf(stderr, "out of memory\n");
+		return -1;
+	}
+
+	for (int i = 0; i < count; ++i) {
+		Word word;
+		if (fscanf(f, " ") < 0 || scan_word(d, f, &word) < 0
+		 || (top[i] = index_of_word(d, &word)) < 0) {
+			fprintf(stderr, "error: unknown word on line %d\n", line);
+			free(top);
+			return -1;
+		}
+	}
+
+	if (fgetc(f) != '\n') {
+		fprintf(stderr, "error: expected end of line %d\n", line);
+		free(top);
+		return -1;
+	}
+
+	return append_second_guess(d, pattern_code(wc), score, num_out, count, top);
+}
+
+int
+read_second_guesses(Dict *d, FILE *f, int *line)
+{
+	free_second_guesses(d);
+
+	int ch, rc = 0;
+	while (rc == 0 && (ch = fgetc(f)) == '#') {
+		char section[16];
+		if (fscanf(f, "%15s", section) != 1 || strcmp(section, "SECOND")) {
+			fprintf(stderr, "error: unknown section on line %d\n", *line);
+			rc = -1;
+			break;
+		}
+
+		rc = read_second_guess(d, f, *line);
+		++*line;
+	}
+
+	return rc;
+}
+
+void
+write_second_guesses(const Dict *d, FILE *f)
+{
+	for (int i = 0; i < d->num_second_guesses; ++i) {
+		const SecondGuess *sg = &d->second_guesses[i];
+
+		WordColor wc;
+		pattern_colors(wc, sg->pattern);
+
+		fprintf(f, "#SECOND ");
+		for (int j = 0; j < 5; ++j)
+			fputc(color_chars[wc[j]], f);
+		fprintf(f, " %.17g %d %d", sg->score, sg->num_out, sg->count);
+
+		for (int j = 0; j < sg->count; ++j) {
+			fputc(' ', f);
+			print_word(d, f, &d->words[sg->top[j]]);
+		}
+		fputc('\n', f);
+	}
+}
+
+const SecondGuess *
+find_second_guess(const Game *g, const Know *know)
+{
+	if (g->score_mode != SM_PARTITION || g->score_metric != MT_SQUARES || g->suggest_slurs)
+		return NULL;
+
+	const Dict *d = g->dict;
+	for (int i = 0; i < d->num_second_guesses; ++i) {
+		const SecondGuess *sg = &d->second_guesses[i];
+		const Know *k = &sg->know;
+		if (memcmp(k->exclude, know->exclude, sizeof(k->exclude))
+		 || k->hist[0] != know->hist[0] || k->hist[1] != know->hist[1])
+			continue;
+
+		/* g may have filtered its options by other knowledge */
+		if (sg->opt_catalog != g->opt_catalog || sg->num_opts != g->num_opts)
+			return NULL;
+		return sg;
+	}
+
+	return NULL;
+}
@@ -0,0 +1,396 @@
+/*
+ * Tools for making educated word1e guesses.
+ * Copyright (C) 2023 Antonie Blom
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ * USA
+ */
+
+#include <text.h>
+#include <dict.h>
+#include <score.h>
+#include <threadpool.h>
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define PARSE_CHUNK (1 << 18) /* bytes per task, roughly */
+#define MAX_TASKS   64
+
+/* What scan_letter does with each character, without calling toupper
+ * or searching the digraphs. */
+typedef struct {
+	int8_t code[256];   /* letter - 'A', or -1 if not a letter */
+	int8_t snd[26];     /* code of the second letter of the digraph
+	                     * starting with it, or -1 if there's none */
+	uint8_t repr[26];   /* its code */
+} LetterTable;
+
+typedef struct {
+	const LetterTable *lt;
+	const char *from, *to;
+	Word *words;
+	WordAttr *attrs;
+	int count;
+
+	const char *error; /* message, with the line number to fill in */
+	const char *error_at;
+} ParseTask;
+
+int
+text_open(Text *t, FILE *f)
+{
+	memset(t, 0, sizeof(*t));
+
+	long pos = ftell(f);
+	struct stat st;
+	if (pos >= 0 && fstat(fileno(f), &st) == 0 && S_ISREG(st.st_mode) && st.st_size > pos) {
+		void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(f), 0);
+		if (map != MAP_FAILED) {
+			t->map = map;
+			t->map_size = st.st_size;
+			t->buf = (char *)map + pos;
+			t->size = st.st_size - pos;
+			return 0;
+		}
+	}
+
+	size_t capacity = 0;
+	for (;;) {
+		if (t->size == capacity) {
+			capacity = capacity ? 2 * capacity : 65536;
+			char *copy = realloc(t->copy, capacity);
+			if (copy == NULL) {
+				fprintf(stderr, "out of memory\n");
+				text_close(t);
+				return -1;
+			}
+
+			t->copy = copy;
+		}
+
+		size_t n = fread(t->copy + t->size, 1, capacity - t->size, f);
+		if (n == 0)
+			break;
+		t->size += n;
+	}
+
+	if (ferror(f)) {
+		perror("index");
+		text_close(t);
+		return -1;
+	}
+
+	t->buf = t->copy;
+	return 0;
+}
+
+void
+text_close(Text *t)
+{
+	if (t->map != NULL)
+		munmap(t->map, t->map_size);
+	free(t->copy);
+	memset(t, 0, sizeof(*t));
+}
+
+static void
+letter_table(LetterTable *lt, const Dict *d)
+{
+	memset(lt->code, -1, sizeof(lt->code));
+	memset(lt->snd, -1, sizeof(lt->snd));
+	for (int c = 0; c < 26; ++c)
+		lt->code['A' + c] = lt->code['a' + c] = c;
+
+	/* backwards, so that the first digraph for a letter wins */
+	for (int i = d->num_digraphs - 1; i >= 0; --i) {
+		const Digraph *di = &d->digraphs[i];
+		if (di->fst >= 'A' && di->fst <= 'Z' && di->snd >= 'A' && di->snd <= 'Z') {
+			lt->snd[di->fst - 'A'] = di->snd - 'A';
+			lt->repr[di->fst - 'A'] = di->repr - 'A';
+		}
+	}
+}
+
+static inline bool
+is_space(char c)
+{
+	return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+/* scan_word on the text at *s. */
+static int
+decode_word(const LetterTable *lt, const char **s, const char *end, Word *out)
+{
+	const char *p = *s;
+
+	/* as word_set_letter packs them */
+	uint32_t packed = 0;
+	for (int i = 0; i < 5; ++i) {
+		while (p < end && *p == '-')
+			++p;
+		if (p == end)
+			return -1;
+
+		int code = lt->code[(uint8_t)*p++];
+		if (code < 0)
+			return -1;
+
+		int snd = lt->snd[code];
+		if (snd >= 0 && p < end && lt->code[(uint8_t)*p] == snd) {
+			code = lt->repr[code];
+			++p;
+		}
+
+		packed = packed << 5 | code;
+	}
+
+	out->packed = packed;
+	*s = p;
+	return 0;
+}
+
+static void
+fail(ParseTask *t, const char *at, const char *error)
+{
+	t->error = error;
+	t->error_at = at;
+}
+
+static void
+parse_words(void *arg)
+{
+	ParseTask *t = arg;
+	const char *s = t->from;
+
+	for (t->count = 0;; ++t->count) {
+		while (s < t->to && is_space(*s))
+			++s;
+		if (s == t->to)
+			break;
+
+		if (decode_word(t->lt, &s, t->to, &t->words[t->count]) < 0) {
+			fail(t, s, "error: line %d\n");
+			return;
+		}
+	}
+}
+
+/* One line of a text index: a word, its starting score in millionths
+ * and its attributes, as in `WORD 0.123456 tx'. */
+static void
+parse_entries(void *arg)
+{
+	ParseTask *t = arg;
+	const char *s = t->from, *end = t->to;
+
+	int last_score = ATTR_SCORE_ONE;
+	for (t->count = 0; s < end; ++t->count) {
+		const char *line = s;
+		if (decode_word(t->lt, &s, end, &t->words[t->count]) < 0) {
+			fail(t, line, "error: line %d\n");
+			return;
+		}
+
+		while (s < end && (*s == ' ' || *s == '\t'))
+			++s;
+
+		int iscore = 0, digits = 0;
+		if (end - s < 2 || s[0] != '0' || s[1] != '.') {
+			fail(t, line, "error: wrong index on line %d\n");
+			return;
+		}
+		for (s += 2; s < end && digits < 6 && *s >= '0' && *s <= '9'; ++s, ++digits)
+			iscore = iscore * 10 + (*s - '0');
+		if (digits == 0) {
+			fail(t, line, "error: wrong index on line %d\n");
+			return;
+		}
+
+		if (iscore > last_score) {
+			fail(t, line, "error: words must be given in decreasing scoring order (line %d)\n");
+			return;
+		}
+
+		t->attrs[t->count].starting_score = last_score = iscore;
+
+		int attr = 0;
+		if (*s == ' ') {
+			for (++s; *s != '\n'; ++s) {
+				switch (*s) {
+				case 't':
+					attr |= WA_TARGET;
+					break;
+				case 'x':
+					attr |= WA_EXPLICIT;
+					break;
+				case 's':
+					attr |= WA_SLUR;
+					break;
+				default:
+					fail(t, line, "error: unexpected attribute character (line %d)\n");
+					return;
+				}
+			}
+		} else if (*s != '\n') {
+			fail(t, line, "error: expected whitespace (line %d)\n");
+			return;
+		}
+
+		t->attrs[t->count].flags = attr;
+		++s;
+	}
+}
+
+static int
+count_lines(const char *s, const char *end)
+{
+	int n = 0;
+	for (; (s = memchr(s, '\n', end - s)) != NULL; ++s)
+		++n;
+	return n;
+}
+
+static void
+report(const Text *t, const char *at, const char *error, int line)
+{
+	fprintf(stderr, error, line + count_lines(t->buf, at));
+}
+
+/* Splits [from, end) into tasks of about PARSE_CHUNK bytes that start
+ * at the beginning of a line. */
+static int
+split_lines(ParseTask *tasks, const char *from, const char *end)
+{
+	int num_tasks = 1 + (end - from) / PARSE_CHUNK;
+	if (num_tasks > MAX_TASKS)
+		num_tasks = MAX_TASKS;
+
+	int n = 0;
+	for (int i = 0; i < num_tasks; ++i) {
+		const char *s = from + (end - from) / num_tasks * i;
+		if (i > 0) {
+			s = memchr(s - 1, '\n', end - s + 1);
+			s = (s == NULL) ? end : s + 1;
+		}
+
+		if (n > 0 && s <= tasks[n - 1].from)
+			continue;
+		if (n > 0)
+			tasks[n - 1].to = s;
+
+		memset(&tasks[n], 0, sizeof(tasks[n]));
+		tasks[n].from = s;
+		tasks[n++].to = end;
+	}
+
+	return n;
+}
+
+ssize_t
+text_words(const Dict *d, const Text *t, Word **words_out)
+{
+	LetterTable lt;
+	letter_table(&lt, d);
+
+	ParseTask tasks[MAX_TASKS];
+	int num_tasks = split_lines(tasks, t->buf, t->buf + t->size);
+
+	/* every word takes up at least five bytes */
+	Word *words = malloc(sizeof(Word) * (t->size / 5 + num_tasks));
+	if (words == NULL) {
+		fprintf(stderr, "out of memory\n");
+		return -1;
+	}
+
+	Word *out = words;
+	for (int i = 0; i < num_tasks; ++i) {
+		tasks[i].lt = &lt;
+		tasks[i].words = out;
+		out += (tasks[i].to - tasks[i].from) / 5 + 1;
+	}
+
+	threadpool_run(num_tasks > 1 ? score_pool() : NULL, parse_words, tasks, num_tasks, sizeof(tasks[0]));
+
+	ssize_t count = 0;
+	for (int i = 0; i < num_tasks; ++i) {
+		if (tasks[i].error != NULL) {
+			report(t, tasks[i].error_at, tasks[i].error, 1);
+			free(words);
+			return -1;
+		}
+
+		memmove(&words[count], tasks[i].words, sizeof(Word) * tasks[i].count);
+		count += tasks[i].count;
+	}
+
+	Word *resized_words = realloc(words, sizeof(Word) * (count + 1));
+	if (resized_words != NULL)
+		words = resized_words;
+
+	*words_out = words;
+	return count;
+}
+
+long
+text_entries(Dict *d, const Text *t, int *line)
+{
+	LetterTable lt;
+	letter_table(&lt, d);
+
+	/* entries can't be told from what follows them but by counting */
+	const char *end = t->buf, *stop = t->buf + t->size;
+	for (int i = 0; i < d->num_words; ++i) {
+		end = memchr(end, '\n', stop - end);
+		if (end == NULL) {
+			fprintf(stderr, "error: unexpected eof on line %d\n", *line + i);
+			return -1;
+		}
+		++end;
+	}
+
+	ParseTask tasks[MAX_TASKS];
+	int num_tasks = split_lines(tasks, t->buf, end);
+
+	int first = 0;
+	for (int i = 0; i < num_tasks; ++i) {
+		tasks[i].lt = &lt;
+		tasks[i].words = &d->words[first];
+		tasks[i].attrs = &d->attrs[first];
+		first += count_lines(tasks[i].from, tasks[i].to);
+	}
+
+	threadpool_run(num_tasks > 1 ? score_pool() : NULL, parse_entries, tasks, num_tasks, sizeof(tasks[0]));
+
+	/* each task only checks the order of its own entries */
+	for (int i = 0; i < num_tasks; ++i) {
+		if (i > 0 && tasks[i].count > 0
+		 && tasks[i].attrs[0].starting_score > tasks[i].attrs[-1].starting_score) {
+			report(t, tasks[i].from, "error: words must be given in decreasing scoring order (line %d)\n", *line);
+			return -1;
+		}
+
+		if (tasks[i].error != NULL) {
+			report(t, tasks[i].error_at, tasks[i].error, *line);
+			return -1;
+		}
+	}
+
+	*line += d->num_words;
+	return end - t->buf;
+}
@@ -29,14 +29,25 @@
 /**
  * @file threadpool.c
  * @brief Threadpool implementation file
+ *
+ * Every worker owns a Chase-Lev work-stealing deque. Tasks added from
+ * within a worker go to the bottom of its own deque; tasks added from
+ * other threads go to a shared injection queue. Idle workers pop their
+ * own deque, then steal from the top of the others' deques, then take
+ * from the injection queue, and finally park on a condition variable.
  */
 
 #include <stdlib.h>
 #include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
 #include <unistd.h>
 
 #include <threadpool.h>
 
+#define DEQUE_SIZE 1024 /* must be a power of two */
+#define SPIN_ROUNDS 64
+
 typedef enum {
 	IMMEDIATE_SHUTDOWN = 1,
 	GRACEFUL_SHUTDOWN  = 2
@@ -55,18 +66,62 @@ typedef struct {
 	void *argument;
 } threadpool_task_t;
 
+/**
+ *  @struct threadpool_slot
+ *  @brief a deque entry; thieves may read a slot while it is being
+ *  reused, but only keep what they read if they win the task
+ *
+ *  @var function Pointer to the function that will perform the task.
+ *  @var argument Argument to be passed to the function.
+ */
+typedef struct {
+	_Atomic(void (*)(void *)) function;
+	_Atomic(void *) argument;
+} threadpool_slot_t;
+
+/**
+ *  @struct threadpool_deque
+ *  @brief a Chase-Lev deque, pushed and popped at the bottom by its
+ *  owner and stolen from at the top by everyone else
+ *
+ *  @var top    Index of the oldest task.
+ *  @var bottom Index one past the newest task.
+ *  @var slots  Circular task buffer of DEQUE_SIZE entries.
+ */
+typedef struct {
+	atomic_long top;
+	atomic_long bottom;
+	threadpool_slot_t slots[DEQUE_SIZE];
+} threadpool_deque_t;
+
+/**
+ *  @struct threadpool_worker
+ *  @brief per-thread state
+ *
+ *  @var pool  The pool the worker belongs to.
+ *  @var deque The worker's own deque.
+ *  @var seed  State of the generator picking steal victims.
+ */
+typedef struct {
+	struct threadpool_t *pool;
+	threadpool_deque_t deque;
+	unsigned seed;
+} threadpool_worker_t;
+
 /**
  *  @struct threadpool
  *  @brief The threadpool struct
  *
- *  @var notify       Condition variable to notify worker threads.
+ *  @var notify       Condition variable to wake up parked workers.
  *  @var threads      Array containing worker threads ID.
+ *  @var workers      Array containing worker state.
  *  @var thread_count Number of threads
- *  @var queue        Array containing the task queue.
- *  @var queue_size   Size of the task queue.
+ *  @var queue        Array containing the injection queue.
+ *  @var queue_size   Size of the injection queue.
  *  @var head         Index of the first element.
  *  @var tail         Index of the next element.
- *  @var count        Number of pending tasks
+ *  @var count        Number of tasks in the injection queue
+ *  @var sleeping     Number of parked workers
  *  @var shutdown     Flag indicating if the pool is shutting down
  *  @var started      Number of started threads
  */
@@ -74,25 +129,187 @@ struct threadpool_t {
 	pthread_mutex_t lock;
 	pthread_cond_t notify;
 	pthread_t *threads;
+	threadpool_worker_t *workers;
 	threadpool_task_t *queue;
 	int thread_count;
 	int queue_size;
 	int head;
 	int tail;
-	int count;
-	int shutdown;
+	atomic_int count;
+	atomic_int sleeping;
+	atomic_int shutdown;
 	int started;
 };
 
+/**
+ *  @struct threadpool_batch
+ *  @brief a batch of tasks run by threadpool_run
+ *
+ *  @var routine  Function performing each task.
+ *  @var args     Task arguments.
+ *  @var size     Size of each argument.
+ *  @var count    Number of tasks.
+ *  @var next     Index of the next task to claim.
+ *  @var done     Number of finished tasks.
+ *  @var refs     References held by the caller and queued runners.
+ *  @var finished Condition variable signalled when all tasks are done.
+ */
+typedef struct {
+	void (*routine)(void *);
+	char *args;
+	size_t size;
+	int count;
+	atomic_int next;
+	atomic_int done;
+	atomic_int refs;
+	pthread_mutex_t lock;
+	pthread_cond_t finished;
+} threadpool_batch_t;
+
+static __thread threadpool_worker_t *current_worker;
+
 /**
  * @function void *threadpool_thread(void *threadpool)
  * @brief the worker thread
- * @param threadpool the pool which own the thread
+ * @param worker the worker state of the thread
  */
-static void *threadpool_thread(void *threadpool);
+static void *threadpool_thread(void *worker);
 
 int threadpool_free(threadpool_t *pool);
 
+static void
+slot_write(threadpool_slot_t *slot, threadpool_task_t task)
+{
+	atomic_store_explicit(&slot->function, task.function, memory_order_relaxed);
+	atomic_store_explicit(&slot->argument, task.argument, memory_order_relaxed);
+}
+
+static threadpool_task_t
+slot_read(threadpool_slot_t *slot)
+{
+	threadpool_task_t task;
+	task.function = atomic_load_explicit(&slot->function, memory_order_relaxed);
+	task.argument = atomic_load_explicit(&slot->argument, memory_order_relaxed);
+	return task;
+}
+
+static int
+deque_push(threadpool_deque_t *d, threadpool_task_t task)
+{
+	long b = atomic_load_explicit(&d->bottom, memory_order_relaxed);
+	long t = atomic_load_explicit(&d->top, memory_order_acquire);
+
+	if(b - t >= DEQUE_SIZE - 1) {
+		return -1;
+	}
+
+	slot_write(&d->slots[b & (DEQUE_SIZE - 1)], task);
+	atomic_store_explicit(&d->bottom, b + 1, memory_order_release);
+	return 0;
+}
+
+static int
+deque_pop(threadpool_deque_t *d, threadpool_task_t *task)
+{
+	long b = atomic_load_explicit(&d->bottom, memory_order_relaxed) - 1;
+	atomic_store_explicit(&d->bottom, b, memory_order_release);
+	atomic_thread_fence(memory_order_seq_cst);
+	long t = atomic_load_explicit(&d->top, memory_order_relaxed);
+
+	if(t > b) {
+		/* Empty */
+		atomic_store_explicit(&d->bottom, b + 1, memory_order_release);
+		return -1;
+	}
+
+	*task = slot_read(&d->slots[b & (DEQUE_SIZE - 1)]);
+	if(t == b) {
+		/* Last task: race the thieves for it */
+		int won = atomic_compare_exchange_strong_explicit(&d->top, &t, t + 1,
+			memory_order_seq_cst, memory_order_relaxed);
+		atomic_store_explicit(&d->bottom, b + 1, memory_order_release);
+		return won ? 0 : -1;
+	}
+
+	return 0;
+}
+
+static int
+deque_steal(threadpool_deque_t *d, threadpool_task_t *task)
+{
+	long t = atomic_load_explicit(&d->top, memory_order_acquire);
+	atomic_thread_fence(memory_order_seq_cst);
+	long b = atomic_load_explicit(&d->bottom, memory_order_acquire);
+
+	if(t >= b) {
+		return -1;
+	}
+
+	*task = slot_read(&d->slots[t & (DEQUE_SIZE - 1)]);
+	if(!atomic_compare_exchange_strong_explicit(&d->top, &t, t + 1,
+		memory_order_seq_cst, memory_order_relaxed)) {
+		return -1;
+	}
+
+	return 0;
+}
+
+static int
+queue_take(threadpool_t *pool, threadpool_task_t *task)
+{
+	int err = -1;
+
+	if(atomic_load(&pool->count) == 0) {
+		return -1;
+	}
+
+	pthread_mutex_lock(&(pool->lock));
+	if(pool->count > 0) {
+		*task = pool->queue[pool->head];
+		pool->head = (pool->head + 1) % pool->queue_size;
+		pool->count -= 1;
+		err = 0;
+	}
+	pthread_mutex_unlock(&(pool->lock));
+
+	return err;
+}
+
+/* Looks for work: own deque first, then the other deques starting at
+   a random victim, then the injection queue. */
+static int
+find_task(threadpool_worker_t *self, threadpool_task_t *task)
+{
+	threadpool_t *pool = self->pool;
+	int i, n = pool->thread_count;
+
+	if(deque_pop(&self->deque, task) == 0) {
+		return 0;
+	}
+
+	self->seed = self->seed * 1103515245 + 12345;
+	int first = (self->seed >> 16) % n;
+	for(i = 0; i < n; i++) {
+		threadpool_worker_t *victim = &pool->workers[(first + i) % n];
+		if(victim != self && deque_steal(&victim->deque, task) == 0) {
+			return 0;
+		}
+	}
+
+	return queue_take(pool, task);
+}
+
+static void
+wake_worker(threadpool_t *pool)
+{
+	atomic_thread_fence(memory_order_seq_cst);
+	if(atomic_load(&pool->sleeping) > 0) {
+		pthread_mutex_lock(&(pool->lock));
+		pthread_cond_signal(&(pool->notify));
+		pthread_mutex_unlock(&(pool->lock));
+	}
+}
+
 threadpool_t *
 threadpool_create(int thread_count, int queue_size, int flags)
 {
@@ -111,11 +328,16 @@ threadpool_create(int thread_count, int queue_size, int flags)
 	/* Initialize */
 	pool->thread_count = 0;
 	pool->queue_size = queue_size;
-	pool->head = pool->tail = pool->count = 0;
-	pool->shutdown = pool->started = 0;
+	pool->head = pool->tail = 0;
+	atomic_init(&pool->count, 0);
+	atomic_init(&pool->sleeping, 0);
+	atomic_init(&pool->shutdown, 0);
+	pool->started = 0;
 
-	/* Allocate thread and task queue */
+	/* Allocate thread, worker and task queue */
 	pool->threads = (pthread_t *)malloc(sizeof(pthread_t) * thread_count);
+	pool->workers = (threadpool_worker_t *)malloc
+		(sizeof(threadpool_worker_t) * thread_count);
 	pool->queue = (threadpool_task_t *)malloc
 		(sizeof(threadpool_task_t) * queue_size);
 
@@ -123,18 +345,30 @@ threadpool_create(int thread_count, int queue_size, int flags)
 	if((pthread_mutex_init(&(pool->lock), NULL) != 0) ||
 	   (pthread_cond_init(&(pool->notify), NULL) != 0) ||
 	   (pool->threads == NULL) ||
+	   (pool->workers == NULL) ||
 	   (pool->queue == NULL)) {
 		goto err;
 	}
 
+	for(i = 0; i < thread_count; i++) {
+		pool->workers[i].pool = pool;
+		pool->workers[i].seed = i + 1;
+		atomic_init(&pool->workers[i].deque.top, 0);
+		atomic_init(&pool->workers[i].deque.bottom, 0);
+	}
+
+	/* Workers steal from each other, so all of them must be counted
+	   before the first one starts. */
+	pool->thread_count = thread_count;
+
 	/* Start worker threads */
 	for(i = 0; i < thread_count; i++) {
 		if(pthread_create(&(pool->threads[i]), NULL,
-						  threadpool_thread, (void*)pool) != 0) {
+						  threadpool_thread, (void*)&pool->workers[i]) != 0) {
+			pool->thread_count = i;
 			threadpool_destroy(pool, 0);
 			return NULL;
 		}
-		pool->thread_count++;
 		pool->started++;
 	}
 
@@ -151,19 +385,31 @@ int
 threadpool_add(threadpool_t *pool, void (*function)(void *), void *argument, int flags)
 {
 	int err = 0;
-	int next;
+	threadpool_task_t task;
 	(void) flags;
 
 	if(pool == NULL || function == NULL) {
 		return THREADPOOL_INVALID;
 	}
 
+	if(atomic_load(&pool->shutdown)) {
+		return THREADPOOL_SHUTDOWN;
+	}
+
+	task.function = function;
+	task.argument = argument;
+
+	/* Workers keep their own tasks */
+	if(current_worker != NULL && current_worker->pool == pool &&
+	   deque_push(&current_worker->deque, task) == 0) {
+		wake_worker(pool);
+		return 0;
+	}
+
 	if(pthread_mutex_lock(&(pool->lock)) != 0) {
 		return THREADPOOL_LOCK_FAILURE;
 	}
 
-	next = (pool->tail + 1) % pool->queue_size;
-
 	do {
 		/* Are we full ? */
 		if(pool->count == pool->queue_size) {
@@ -178,13 +424,11 @@ threadpool_add(threadpool_t *pool, void (*function)(void *), void *argument, int
 		}
 
 		/* Add task to queue */
-		pool->queue[pool->tail].function = function;
-		pool->queue[pool->tail].argument = argument;
-		pool->tail = next;
+		pool->queue[pool->tail] = task;
+		pool->tail = (pool->tail + 1) % pool->queue_size;
 		pool->count += 1;
 
-		/* pthread_cond_broadcast */
-		if(pthread_cond_signal(&(pool->notify)) != 0) {
+		if(pool->sleeping > 0 && pthread_cond_signal(&(pool->notify)) != 0) {
 			err = THREADPOOL_LOCK_FAILURE;
 			break;
 		}
@@ -197,6 +441,98 @@ threadpool_add(threadpool_t *pool, void (*function)(void *), void *argument, int
 	return err;
 }
 
+static void
+batch_release(threadpool_batch_t *batch)
+{
+	if(atomic_fetch_sub(&batch->refs, 1) == 1) {
+		pthread_mutex_destroy(&(batch->lock));
+		pthread_cond_destroy(&(batch->finished));
+		free(batch);
+	}
+}
+
+static void
+batch_work(threadpool_batch_t *batch)
+{
+	int i, n = 0;
+
+	while((i = atomic_fetch_add(&batch->next, 1)) < batch->count) {
+		batch->routine(batch->args + i * batch->size);
+		n++;
+	}
+
+	if(n > 0 && atomic_fetch_add(&batch->done, n) + n == batch->count) {
+		pthread_mutex_lock(&(batch->lock));
+		pthread_cond_broadcast(&(batch->finished));
+		pthread_mutex_unlock(&(batch->lock));
+	}
+}
+
+static void
+batch_runner(void *arg)
+{
+	batch_work(arg);
+	batch_release(arg);
+}
+
+int
+threadpool_run(threadpool_t *pool, void (*routine)(void *), void *args, int count, size_t size)
+{
+	threadpool_batch_t *batch;
+	int i, runners;
+
+	if(routine == NULL || count < 0) {
+		return THREADPOOL_INVALID;
+	}
+
+	if(pool == NULL || count <= 1) {
+		for(i = 0; i < count; i++) {
+			routine((char *)args + i * size);
+		}
+		return 0;
+	}
+
+	if((batch = (threadpool_batch_t *)malloc(sizeof(threadpool_batch_t))) == NULL) {
+		return THREADPOOL_INVALID;
+	}
+
+	batch->routine = routine;
+	batch->args = args;
+	batch->size = size;
+	batch->count = count;
+	atomic_init(&batch->next, 0);
+	atomic_init(&batch->done, 0);
+	atomic_init(&batch->refs, 1);
+
+	if((pthread_mutex_init(&(batch->lock), NULL) != 0) ||
+	   (pthread_cond_init(&(batch->finished), NULL) != 0)) {
+		free(batch);
+		return THREADPOOL_LOCK_FAILURE;
+	}
+
+	/* Tasks are claimed one by one, so one runner per thread is
+	   plenty; whatever isn't picked up is done by the caller. */
+	runners = (count - 1 < pool->thread_count) ? count - 1 : pool->thread_count;
+	for(i = 0; i < runners; i++) {
+		atomic_fetch_add(&batch->refs, 1);
+		if(threadpool_add(pool, batch_runner, batch, 0) != 0) {
+			atomic_fetch_sub(&batch->refs, 1);
+			break;
+		}
+	}
+
+	batch_work(batch);
+
+	pthread_mutex_lock(&(batch->lock));
+	while(atomic_load(&batch->done) < count) {
+		pthread_cond_wait(&(batch->finished), &(batch->lock));
+	}
+	pthread_mutex_unlock(&(batch->lock));
+
+	batch_release(batch);
+	return 0;
+}
+
 int
 threadpool_destroy(threadpool_t *pool, int flags)
 {
@@ -214,6 +550,7 @@ threadpool_destroy(threadpool_t *pool, int flags)
 		/* Already shutting down */
 		if(pool->shutdown) {
 			err = THREADPOOL_SHUTDOWN;
+			pthread_mutex_unlock(&(pool->lock));
 			break;
 		}
 
@@ -252,6 +589,7 @@ threadpool_free(threadpool_t *pool)
 	/* Did we manage to allocate ? */
 	if(pool->threads) {
 	    free(pool->threads);
+	    free(pool->workers);
 	    free(pool->queue);
  
 	    /* Because we allocate pool->threads after initializing the
@@ -267,43 +605,77 @@ threadpool_free(threadpool_t *pool)
 
 
 static void *
-threadpool_thread(void *threadpool)
+threadpool_thread(void *worker)
 {
-	threadpool_t *pool = (threadpool_t *)threadpool;
+	threadpool_worker_t *self = (threadpool_worker_t *)worker;
+	threadpool_t *pool = self->pool;
 	threadpool_task_t task;
+	int spins = 0;
+
+	current_worker = self;
 
 	for(;;) {
-		/* Lock must be taken to wait on conditional variable */
-		pthread_mutex_lock(&(pool->lock));
+		if(atomic_load(&pool->shutdown) == IMMEDIATE_SHUTDOWN) {
+			break;
+		}
 
-		/* Wait on condition variable, check for spurious wakeups.
-		   When returning from pthread_cond_wait(), we own the lock. */
-		while((pool->count == 0) && (!pool->shutdown)) {
-			pthread_cond_wait(&(pool->notify), &(pool->lock));
+		if(find_task(self, &task) == 0) {
+			spins = 0;
+
+			/* Get to work */
+			(*(task.function))(task.argument);
+			continue;
 		}
 
-		if((pool->shutdown == IMMEDIATE_SHUTDOWN) ||
-		   ((pool->shutdown == GRACEFUL_SHUTDOWN) &&
-			(pool->count == 0))) {
-			break;
+		if(spins++ < SPIN_ROUNDS) {
+			sched_yield();
+			continue;
 		}
 
-		/* Grab our task */
-		task.function = pool->queue[pool->head].function;
-		task.argument = pool->queue[pool->head].argument;
-		pool->head = (pool->head + 1) % pool->queue_size;
-		pool->count -= 1;
+		/* Park. Announcing ourselves before the final check means
+		   anyone adding a task after it will see us and signal. */
+		pthread_mutex_lock(&(pool->lock));
+		atomic_fetch_add(&pool->sleeping, 1);
+		atomic_thread_fence(memory_order_seq_cst);
+
+		/* The injection queue is ours to check under the lock;
+		   stealing never blocks, so the deques can be checked too. */
+		int found = 0;
+		if(pool->count > 0) {
+			task = pool->queue[pool->head];
+			pool->head = (pool->head + 1) % pool->queue_size;
+			pool->count -= 1;
+			found = 1;
+		} else {
+			for(int i = 0; i < pool->thread_count && !found; i++) {
+				found = deque_steal(&pool->workers[i].deque, &task) == 0;
+			}
+		}
+
+		if(!found && !pool->shutdown) {
+			pthread_cond_wait(&(pool->notify), &(pool->lock));
+		}
 
-		/* Unlock */
+		atomic_fetch_sub(&pool->sleeping, 1);
+		int stop = !found && pool->shutdown;
 		pthread_mutex_unlock(&(pool->lock));
 
-		/* Get to work */
-		(*(task.function))(task.argument);
+		if(found) {
+			spins = 0;
+			(*(task.function))(task.argument);
+		} else if(stop) {
+			/* Graceful shutdown: nothing left anywhere */
+			break;
+		} else {
+			spins = 0;
+		}
 	}
 
+	pthread_mutex_lock(&(pool->lock));
 	pool->started--;
-
 	pthread_mutex_unlock(&(pool->lock));
+
+	current_worker = NULL;
 	pthread_exit(NULL);
 	return(NULL);
 }
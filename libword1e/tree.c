@@ -0,0 +1,400 @@
+/*
+ * Tools for making educated word1e guesses.
+ * Copyright (C) 2023 Antonie Blom
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ * USA
+ */
+
+#include <tree.h>
+#include <game.h>
+#include <optimal.h>
+#include <pattern.h>
+#include <score.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#define TREE_MAGIC   0x45525457 /* "WTRE" */
+#define TREE_VERSION 1
+
+/* Stored in host byte order; trees aren't meant to be moved between
+ * machines, only between runs. */
+typedef struct {
+	uint32_t magic, version;
+	uint32_t num_words;
+	uint32_t num_nodes, num_edges, num_best;
+	uint64_t index_hash;
+} TreeHeader;
+
+typedef struct {
+	Game g; /* plays the tree, so that the caller's options stay */
+	DecisionTree *t;
+	int num_openers;
+	enum tree_policy policy;
+	uint32_t cap_nodes, cap_edges, cap_best;
+	Word *top;
+} Builder;
+
+/* FNV-1a over the words and their flags, which is all a tree depends
+ * on. */
+static uint64_t
+index_hash(const Dict *d)
+{
+	uint64_t hash = 14695981039346656037ULL;
+	for (int i = 0; i < d->num_words; ++i) {
+		uint8_t bytes[6];
+		for (int j = 0; j < 5; ++j)
+			bytes[j] = word_letter(&d->words[i], j);
+		bytes[5] = d->attrs[i].flags;
+
+		for (int j = 0; j < 6; ++j) {
+			hash ^= bytes[j];
+			hash *= 1099511628211ULL;
+		}
+	}
+
+	return hash;
+}
+
+static int
+grow(void **array, uint32_t *cap, uint32_t need, size_t size)
+{
+	if (need <= *cap)
+		return 0;
+
+	uint32_t new_cap = *cap ? *cap : 256;
+	while (new_cap < need)
+		new_cap *= 2;
+
+	void *new_array = realloc(*array, new_cap * size);
+	if (new_array == NULL) {
+		fprintf(stderr, "out of memory\n");
+		return -1;
+	}
+
+	*array = new_array;
+	*cap = new_cap;
+	return 0;
+}
+
+static int
+compare_edges(const void *a, const void *b)
+{
+	const TreeEdge *x = a, *y = b;
+	if (x->guess != y->guess)
+		return (x->guess > y->guess) - (x->guess < y->guess);
+	return (x->pattern > y->pattern) - (x->pattern < y->pattern);
+}
+
+/* Adds the node for know, which targets (words indices) can reach,
+ * and everything below it. Returns its index. */
+static int
+expand(Builder *b, const Know *know, const int *targets, int num_targets, int depth)
+{
+	DecisionTree *t = b->t;
+	const Dict *d = b->g.dict;
+	int num_words = d->num_words;
+
+	if (reset_opts(&b->g, know) < 0)
+		return -1;
+
+	int n = 1;
+	double score;
+	if (b->policy == TP_OPTIMAL) {
+		int g;
+		if (optimal_guess(&b->g, targets, num_targets, &g) < 0)
+			return -1;
+
+		b->top[0] = d->words[g];
+		score = score_guess(&b->g, &b->top[0], know);
+	} else {
+		score = best_guesses(&b->g, b->top, num_words, &n, know);
+	}
+
+	int node = t->num_nodes;
+	if (grow((void **)&t->nodes, &b->cap_nodes, node + 1, sizeof(TreeNode)) < 0)
+		return -1;
+	if (grow((void **)&t->best, &b->cap_best, t->num_best + n, sizeof(uint32_t)) < 0)
+		return -1;
+
+	++t->num_nodes;
+	t->nodes[node].score = score;
+	t->nodes[node].first_best = t->num_best;
+	t->nodes[node].num_best = n;
+	t->nodes[node].first_edge = 0;
+	t->nodes[node].num_edges = 0;
+
+	for (int i = 0; i < n; ++i)
+		t->best[t->num_best++] = index_of_word(d, &b->top[i]);
+
+	if (verbosity > 0)
+		fprintf(stderr, "%u nodes        \r", t->num_nodes);
+
+	if (n <= 0 || depth >= TREE_MAX_DEPTH)
+		return node;
+
+	/* the best guess, and at the root the openers as well */
+	int num_openers = 0;
+	if (has_no_knowledge(know))
+		num_openers = (b->num_openers < num_words) ? b->num_openers : num_words;
+
+	TreeEdge *edges = malloc(sizeof(TreeEdge) * (num_openers + 1) * NUM_PATTERNS);
+	int *guesses = malloc(sizeof(int) * (num_openers + 1));
+	int *sorted = malloc(sizeof(int) * (num_targets + 1));
+	uint8_t *codes = malloc(num_targets + 1);
+	if (edges == NULL || guesses == NULL || sorted == NULL || codes == NULL) {
+		fprintf(stderr, "out of memory\n");
+		goto fail;
+	}
+
+	int num_guesses = 0;
+	guesses[num_guesses++] = t->best[t->nodes[node].first_best];
+	for (int g = 0; g < num_openers; ++g)
+		if (g != guesses[0])
+			guesses[num_guesses++] = g;
+
+	int num_edges = 0;
+	for (int j = 0; j < num_guesses; ++j) {
+		int g = guesses[j];
+		const Word *guess = &d->words[g];
+
+		/* group the targets by the feedback they give */
+		int start[NUM_PATTERNS + 1] = { 0 };
+		for (int i = 0; i < num_targets; ++i) {
+			codes[i] = word_pattern(guess, &d->words[targets[i]]);
+			++start[codes[i] + 1];
+		}
+		for (int p = 0; p < NUM_PATTERNS; ++p)
+			start[p + 1] += start[p];
+
+		int next[NUM_PATTERNS];
+		memcpy(next, start, sizeof(next));
+		for (int i = 0; i < num_targets; ++i)
+			sorted[next[codes[i]]++] = targets[i];
+
+		for (int p = 0; p < NUM_PATTERNS; ++p) {
+			int count = start[p + 1] - start[p];
+			WordColor wc;
+			pattern_colors(wc, p);
+			if (count == 0 || all_green(wc))
+				continue;
+
+			Know new, child_know = *know;
+			knowledge_from_colors(&new, guess, wc);
+			absorb_knowledge(&child_know, &new);
+
+			int child = expand(b, &child_know, sorted + start[p], count, depth + 1);
+			if (child < 0)
+				goto fail;
+
+			edges[num_edges].guess = g;
+			edges[num_edges].pattern = p;
+			edges[num_edges].child = child;
+			++num_edges;
+		}
+	}
+
+	qsort(edges, num_edges, sizeof(TreeEdge), compare_edges);
+
+	if (grow((void **)&t->edges, &b->cap_edges, t->num_edges + num_edges, sizeof(TreeEdge)) < 0)
+		goto fail;
+
+	t->nodes[node].first_edge = t->num_edges;
+	t->nodes[node].num_edges = num_edges;
+	memcpy(t->edges + t->num_edges, edges, sizeof(TreeEdge) * num_edges);
+	t->num_edges += num_edges;
+
+	free(codes);
+	free(sorted);
+	free(guesses);
+	free(edges);
+	return node;
+
+fail:
+	free(codes);
+	free(sorted);
+	free(guesses);
+	free(edges);
+	return -1;
+}
+
+int
+tree_build(DecisionTree *t, const Game *g, int num_openers, enum tree_policy policy)
+{
+	memset(t, 0, sizeof(*t));
+
+	Know know = { 0 };
+	Builder b = { .t = t, .num_openers = num_openers, .policy = policy };
+	if (game_init_from(&b.g, g, &know) < 0)
+		return -1;
+
+	b.top = malloc(sizeof(Word) * g->dict->num_words);
+	int *targets = malloc(sizeof(int) * (b.g.num_opts + 1));
+	if (b.top == NULL || targets == NULL) {
+		fprintf(stderr, "out of memory\n");
+		free(b.top);
+		free(targets);
+		game_free(&b.g);
+		return -1;
+	}
+
+	int num_targets = b.g.num_opts;
+	memcpy(targets, b.g.opts, sizeof(int) * num_targets);
+
+	int root = expand(&b, &know, targets, num_targets, 0);
+
+	free(targets);
+	free(b.top);
+	game_free(&b.g);
+
+	if (root < 0) {
+		tree_free(t);
+		return -1;
+	}
+
+	return 0;
+}
+
+void
+tree_free(DecisionTree *t)
+{
+	free(t->nodes);
+	free(t->edges);
+	free(t->best);
+	memset(t, 0, sizeof(*t));
+}
+
+int
+tree_save(const DecisionTree *t, const Dict *d, FILE *f)
+{
+	TreeHeader h = {
+		.magic = TREE_MAGIC,
+		.version = TREE_VERSION,
+		.num_words = d->num_words,
+		.index_hash = index_hash(d),
+		.num_nodes = t->num_nodes,
+		.num_edges = t->num_edges,
+		.num_best = t->num_best,
+	};
+
+	if (fwrite(&h, sizeof(h), 1, f) != 1
+	 || fwrite(t->nodes, sizeof(TreeNode), t->num_nodes, f) != t->num_nodes
+	 || fwrite(t->edges, sizeof(TreeEdge), t->num_edges, f) != t->num_edges
+	 || fwrite(t->best, sizeof(uint32_t), t->num_best, f) != t->num_best) {
+		perror("tree");
+		return -1;
+	}
+
+	return 0;
+}
+
+int
+tree_load(DecisionTree *t, const Dict *d, FILE *f)
+{
+	memset(t, 0, sizeof(*t));
+
+	TreeHeader h;
+	if (fread(&h, sizeof(h), 1, f) != 1 || h.magic != TREE_MAGIC) {
+		fprintf(stderr, "error: not a decision tree\n");
+		return -1;
+	}
+
+	if (h.version != TREE_VERSION) {
+		fprintf(stderr, "error: unsupported decision tree version %u\n", h.version);
+		return -1;
+	}
+
+	if (h.num_words != (uint32_t)d->num_words || h.index_hash != index_hash(d)) {
+		fprintf(stderr, "error: decision tree was built for another index\n");
+		return -1;
+	}
+
+	/* playback starts at node 0 */
+	if (h.num_nodes == 0) {
+		fprintf(stderr, "error: corrupt decision tree\n");
+		return -1;
+	}
+
+	t->nodes = malloc(sizeof(TreeNode) * (h.num_nodes + 1));
+	t->edges = malloc(sizeof(TreeEdge) * (h.num_edges + 1));
+	t->best = malloc(sizeof(uint32_t) * (h.num_best + 1));
+	if (t->nodes == NULL || t->edges == NULL || t->best == NULL) {
+		fprintf(stderr, "out of memory\n");
+		tree_free(t);
+		return -1;
+	}
+
+	t->num_nodes = h.num_nodes;
+	t->num_edges = h.num_edges;
+	t->num_best = h.num_best;
+
+	if (fread(t->nodes, sizeof(TreeNode), t->num_nodes, f) != t->num_nodes
+	 || fread(t->edges, sizeof(TreeEdge), t->num_edges, f) != t->num_edges
+	 || fread(t->best, sizeof(uint32_t), t->num_best, f) != t->num_best) {
+		fprintf(stderr, "error: truncated decision tree\n");
+		tree_free(t);
+		return -1;
+	}
+
+	/* don't trust the file further than needed for playback */
+	for (uint32_t i = 0; i < t->num_nodes; ++i) {
+		const TreeNode *n = &t->nodes[i];
+		if (n->first_best > t->num_best || n->num_best > t->num_best - n->first_best
+		 || n->first_edge > t->num_edges || n->num_edges > t->num_edges - n->first_edge)
+			goto corrupt;
+	}
+	for (uint32_t i = 0; i < t->num_edges; ++i)
+		if (t->edges[i].child >= t->num_nodes || t->edges[i].guess >= (uint32_t)d->num_words)
+			goto corrupt;
+	for (uint32_t i = 0; i < t->num_best; ++i)
+		if (t->best[i] >= (uint32_t)d->num_words)
+			goto corrupt;
+
+	return 0;
+
+corrupt:
+	fprintf(stderr, "error: corrupt decision tree\n");
+	tree_free(t);
+	return -1;
+}
+
+double
+tree_best(const DecisionTree *t, const Dict *d, int node, Word *top, int max_out, int *num_out)
+{
+	const TreeNode *n = &t->nodes[node];
+	for (uint32_t i = 0; i < n->num_best && i < (uint32_t)max_out; ++i)
+		top[i] = d->words[t->best[n->first_best + i]];
+
+	*num_out = n->num_best;
+	return n->score;
+}
+
+int
+tree_child(const DecisionTree *t, int node, int guess_idx, WordColor colors)
+{
+	if (node < 0 || node >= (int)t->num_nodes || guess_idx < 0)
+		return -1;
+
+	TreeEdge key = { .guess = guess_idx, .pattern = pattern_code(colors) };
+	const TreeNode *n = &t->nodes[node];
+	const TreeEdge *e = bsearch(&key,
+	                            t->edges + n->first_edge,
+	                            n->num_edges,
+	                            sizeof(TreeEdge),
+	                            compare_edges);
+
+	return e ? (int)e->child : -1;
+}
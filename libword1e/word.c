@@ -24,32 +24,90 @@
 #endif
 
 #include <word.h>
+#include <binindex.h>
+#include <bitindex.h>
+#include <cache.h>
+#include <game.h>
+#include <optimal.h>
+#include <pattern.h>
+#include <planes.h>
+#include <second.h>
+#include <text.h>
 
 #include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 
-Word *all_words, *opts;
-Digraph *digraphs;
-WordAttr *word_attrs;
-int num_opts, num_words, verbosity = 0, num_digraphs;
-bool suggest_slurs = false;
-enum option_catalog opt_catalog = OC_NONE;
+int verbosity = 0;
+
+static uint32_t
+word_slot(const Dict *d, uint32_t key)
+{
+	return (key * 0x9e3779b97f4a7c15ULL) >> 32 & d->word_table_mask;
+}
+
+/* Open addressing with linear probing, at most half full. The first of
+ * duplicate words wins, as it did for the linear search. */
+static int
+build_word_table(Dict *d)
+{
+	free(d->word_table);
+	d->word_table = NULL;
+
+	uint32_t size = 64;
+	while (size < 2 * (uint32_t)d->num_words)
+		size *= 2;
+
+	d->word_table = malloc(sizeof(WordSlot) * size);
+	if (d->word_table == NULL) {
+		fprintf(stderr, "out of memory\n");
+		return -1;
+	}
+
+	d->word_table_mask = size - 1;
+	for (uint32_t i = 0; i < size; ++i)
+		d->word_table[i].idx = -1;
+
+	for (int i = 0; i < d->num_words; ++i) {
+		uint32_t key = d->words[i].packed;
+		uint32_t s = word_slot(d, key);
+		while (d->word_table[s].idx >= 0 && d->word_table[s].key != key)
+			s = (s + 1) & d->word_table_mask;
+
+		if (d->word_table[s].idx < 0) {
+			d->word_table[s].key = key;
+			d->word_table[s].idx = i;
+		}
+	}
+
+	return 0;
+}
 
 int
-index_of_word(const Word *word)
+index_of_word(const Dict *d, const Word *word)
 {
-	for (int i = 0; i < num_words; ++i) {
-		if (memcmp(all_words[i].letters, word->letters, 5) == 0)
-			return i;
+	/* mkwx scores before the index is set up */
+	if (d->word_table == NULL) {
+		for (int i = 0; i < d->num_words; ++i) {
+			if (d->words[i].packed == word->packed)
+				return i;
+		}
+
+		return -1;
 	}
 
+	uint32_t key = word->packed;
+	for (uint32_t s = word_slot(d, key); d->word_table[s].idx >= 0; s = (s + 1) & d->word_table_mask)
+		if (d->word_table[s].key == key)
+			return d->word_table[s].idx;
+
 	return -1;
 }
 
 static int
-scan_letter(FILE *f)
+scan_letter(const Dict *d, FILE *f)
 {
 	int ch;
 	while ((ch = fgetc(f)) == '-')
@@ -59,15 +117,17 @@ scan_letter(FILE *f)
 		return EOF;
 
 	ch = toupper(ch);
+	if (ch < 'A' || ch > 'Z')
+		return -1;
 
-	for (int i = 0; i < num_digraphs; ++i) {
-		if (digraphs[i].fst == ch) {
+	for (int i = 0; i < d->num_digraphs; ++i) {
+		if (d->digraphs[i].fst == ch) {
 			int snd = fgetc(f);
 			if (snd != EOF)
 				snd = toupper(snd);
 
-			if (snd == digraphs[i].snd)
-				ch = digraphs[i].repr;
+			if (snd == d->digraphs[i].snd)
+				ch = d->digraphs[i].repr;
 			else
 				ungetc(snd, f);
 			break;
@@ -78,135 +138,74 @@ scan_letter(FILE *f)
 }
 
 int
-scan_word(FILE *f, Word *out)
+scan_word(const Dict *d, FILE *f, Word *out)
 {
 	memset(out, 0, sizeof(Word));
 	for (int i = 0; i < 5; ++i) {
-		int ch = scan_letter(f);
+		int ch = scan_letter(d, f);
 		if (ch < 0)
 			return -1;
-		out->letters[i] = ch;
-		hist_add_letter(out->hist, ch);
+		word_set_letter(out, i, ch);
 	}
 
 	return 0;
 }
 
 ssize_t
-load_words(FILE *f, Word **words_out)
+load_words(const Dict *d, FILE *f, Word **words_out)
 {
 	if (f == NULL)
 		return -1;
 
-	int line = 1;
-
-	long init_pos = ftell(f);
-	if (init_pos < 0)
-		return -1;
-
-	if (fseek(f, 0, SEEK_END) < 0)
-		return -1;
-
-	long final_pos = ftell(f);
-	if (final_pos < 0)
-		return -1;
-
-	if (fseek(f, init_pos, init_pos) < 0)
-		return -1;
-
-	long size = final_pos - init_pos;
-	size_t max_num_words = (size + 1) / 6;
-
-	if (verbosity > 0)
-		fprintf(stderr, "max %zd words...\n", max_num_words);
-
-	Word *words = malloc(sizeof(Word) * max_num_words);
-
-	if (words == NULL) {
-		fprintf(stderr, "out of memory\n");
+	Text t;
+	if (text_open(&t, f) < 0)
 		return -1;
-	}
 
-	ssize_t i;
-	for (i = 0; i < max_num_words; ++i) {
-		int ch;
-		while (isspace(ch = fgetc(f)) && ch != EOF)
-			if (ch == '\n')
-				++line;
+	ssize_t count = text_words(d, &t, words_out);
+	text_close(&t);
 
-		if (ch == EOF)
-			break;
+	if (verbosity > 0 && count >= 0)
+		fprintf(stderr, "read %zd words...\n", count);
 
-		ungetc(ch, f);
-		if (scan_word(f, &words[i]) < 0) {
-			fprintf(stderr, "error: line %d\n", line);
-			goto error;
-		}
-
-		++line;
-	}
-
-	Word *resized_words = realloc(words, sizeof(Word) * i);
-	if (resized_words != NULL)
-		words = resized_words;
-
-	if (verbosity > 0)
-		fprintf(stderr, "read %zd words...\n", i);
-
-	*words_out = words;
-	return i;
-
-error:
-	free(words);
-	return -1;
+	return count;
 }
 
-static int
-read_attrs(FILE *f, int line)
+void
+dict_init(Dict *d)
 {
-	int ch = fgetc(f);
-	if (ch == '\n')
-		return 0;
-
-	if (ch != ' ') {
-		fprintf(stderr, "error: expected whitespace (line %d)\n", line);
-		return -1;
-	}
+	memset(d, 0, sizeof(*d));
+	pthread_mutex_init(&d->matrix_lock, NULL);
+}
 
-	int res = 0;
-	bool should_break = false;
-	while (!should_break) {
-		switch (fgetc(f)) {
-		case 't':
-			res |= WA_TARGET;
-			break;
-		case 'x':
-			res |= WA_EXPLICIT;
-			break;
-		case 's':
-			res |= WA_SLUR;
-			break;
-		case '\n':
-			should_break = true;
-			break;
-		default:
-			fprintf(stderr, "error: unexpected attribute character (line %d)\n", line);
-			return -1;
-		}
+void
+dict_free(Dict *d)
+{
+	free_pattern_matrix(d);
+	free_second_guesses(d);
+	guess_cache_free(d);
+	optimal_free(d);
+	planes_free(&d->planes);
+	free(d->word_table);
+	pthread_mutex_destroy(&d->matrix_lock);
+
+	if (d->map != NULL) {
+		munmap(d->map, d->map_size);
+	} else {
+		free(d->words);
+		free(d->attrs);
+		free(d->digraphs);
 	}
-
-	return res;
+	memset(d, 0, sizeof(*d));
 }
 
-int
-load_index(FILE *f)
+/* Reads the header with stdio, and the rest from t, which is left
+ * at the second guesses. */
+static int
+read_index(Dict *d, FILE *f, Text *t, int *line_out)
 {
-	if (f == NULL)
-		return -1;
-
 	int line = 1;
 
-	if (fscanf(f, "%d\n", &num_words) != 1) {
+	if (fscanf(f, "%d\n", &d->num_words) != 1 || d->num_words < 0) {
 		fprintf(stderr, "error: expected word count on line 1\n");
 		return -1;
 	}
@@ -221,7 +220,7 @@ load_index(FILE *f)
 		}
 
 		if (!strncmp(lnbuf, "DIGRAPH ", 8)) {
-			if (num_digraphs >= 32 - 26) {
+			if (d->num_digraphs >= 32 - 26) {
 				fprintf(stderr, "error: too many digraphs\n");
 				return -1;
 			}
@@ -232,12 +231,17 @@ load_index(FILE *f)
 				return -1;
 			}
 
-			++num_digraphs;
-			digraphs = realloc(digraphs, sizeof(digraphs[0]) * num_digraphs);
-			Digraph *di = &digraphs[num_digraphs - 1];
+			Digraph *digraphs = realloc(d->digraphs, sizeof(Digraph) * (d->num_digraphs + 1));
+			if (digraphs == NULL) {
+				fprintf(stderr, "out of memory\n");
+				return -1;
+			}
+
+			d->digraphs = digraphs;
+			Digraph *di = &d->digraphs[d->num_digraphs++];
 			di->fst = toupper(fst);
 			di->snd = toupper(snd);
-			di->repr = 'Z' + num_digraphs;
+			di->repr = 'Z' + d->num_digraphs;
 		} else {
 			fprintf(stderr, "error: line %d\n", line);
 			return -1;
@@ -248,55 +252,145 @@ load_index(FILE *f)
 	ungetc(ch, f);
 
 	if (verbosity > 0)
-		fprintf(stderr, "reading %d words...\n", num_words);
+		fprintf(stderr, "reading %d words...\n", d->num_words);
 
-	all_words  = malloc(sizeof(all_words[0])  * num_words);
-	word_attrs = malloc(sizeof(word_attrs[0]) * num_words);
+	d->words = malloc(sizeof(Word) * d->num_words);
+	d->attrs = malloc(sizeof(WordAttr) * d->num_words);
 
-	if (all_words == NULL || word_attrs == NULL) {
+	if (d->words == NULL || d->attrs == NULL) {
 		fprintf(stderr, "out of memory\n");
+		return -1;
+	}
+
+	if (text_open(t, f) < 0)
+		return -1;
+
+	long size = text_entries(d, t, &line);
+	if (size < 0)
+		return -1;
+
+	t->buf += size;
+	t->size -= size;
+
+	*line_out = line;
+	return 0;
+}
+
+static int
+read_rest(Dict *d, const Text *t, int *line)
+{
+	if (t->size == 0)
+		return 0;
 
-		free(all_words);
+	FILE *f = fmemopen((void *)t->buf, t->size, "r");
+	if (f == NULL) {
+		perror("index");
 		return -1;
 	}
 
-	double last_score = 1.0;
-	for (int i = 0; i < num_words; ++i) {
-		if (scan_word(f, &all_words[i]) < 0) {
-			fprintf(stderr, "error: line %d\n", line);
-			return -1;
-		}
+	int rc = read_second_guesses(d, f, line);
+	fclose(f);
+	return rc;
+}
 
-		int iscore;
-		if (fscanf(f, " 0.%6d", &iscore) != 1) {
-			fprintf(stderr, "error: wrong index on line %d\n", line);
-			return -1;
-		}
+int
+load_index(Dict *d, FILE *f)
+{
+	if (f == NULL)
+		return -1;
 
-		double score = iscore / 1000000.0;
-		if (score > last_score) {
-			fprintf(stderr, "error: words must be given in decreasing scoring order (line %d)\n", line);
-			return -1;
-		}
+	dict_init(d);
 
-		word_attrs[i].starting_score = last_score = score;
-		int attr = read_attrs(f, line);
-		if (attr < 0)
-			return -1;
+	/* text indices start with the word count */
+	int ch = fgetc(f);
+	ungetc(ch, f);
+	bool text = ch == EOF || isdigit(ch) || isspace(ch);
+
+	/* second guesses are looked up by word, so they come last */
+	Text t = { 0 };
+	int line;
+	if ((text ? read_index(d, f, &t, &line) : binindex_map(d, f)) < 0
+	 || init_index(d) < 0
+	 || (text && read_rest(d, &t, &line) < 0)
+	 || count_second_guess_opts(d) < 0) {
+		text_close(&t);
+		dict_free(d);
+		return -1;
+	}
 
-		word_attrs[i].flags = attr;
-		++line;
+	text_close(&t);
+
+	return 0;
+}
+
+int
+init_index(Dict *d)
+{
+	free_pattern_matrix(d);
+
+	if (optimal_reset(d) < 0 || guess_cache_clear(d) < 0 || build_word_table(d) < 0)
+		return -1;
+
+	return planes_load(&d->planes, d->words, d->num_words);
+}
+
+int
+game_init(Game *g, Dict *d)
+{
+	memset(g, 0, sizeof(*g));
+	g->dict = d;
+	g->opt_catalog = OC_NONE;
+	g->suggest_slurs = false;
+	g->score_mode = SM_PARTITION;
+	g->score_metric = MT_SQUARES;
+	g->optimal_objective = OO_EXPECTED;
+	g->optimal_width = 0;
+
+	/* without attributes, there is no catalog to take options from */
+	if (d->attrs == NULL)
+		return 0;
+
+	if (update_opts(g, NULL) < 0) {
+		game_free(g);
+		return -1;
 	}
 
-	opt_catalog = OC_NONE;
-	opts = NULL;
-	num_opts = 0;
-	if (update_opts(NULL) < 0)
+	return 0;
+}
+
+int
+game_init_from(Game *g, const Game *from, const Know *know)
+{
+	memset(g, 0, sizeof(*g));
+	g->dict = from->dict;
+	g->opt_catalog = OC_NONE;
+	g->suggest_slurs = from->suggest_slurs;
+	g->score_mode = from->score_mode;
+	g->score_metric = from->score_metric;
+	g->optimal_objective = from->optimal_objective;
+	g->optimal_width = from->optimal_width;
+	g->stats = from->stats;
+
+	if (reset_opts(g, know) < 0) {
+		game_free(g);
 		return -1;
+	}
 
 	return 0;
 }
 
+void
+game_free(Game *g)
+{
+	free(g->opts);
+	planes_free(&g->opt_planes);
+	bitindex_free(&g->opt_index);
+	g->opts = NULL;
+	g->num_opts = 0;
+	g->opt_capacity = 0;
+	g->opt_catalog = OC_NONE;
+}
+
 bool
 has_no_knowledge(const Know *know)
 {
@@ -315,79 +409,154 @@ word_matches(const Word *word, const Know *know)
 {
 	for (int i = 0; i < 5; ++i) {
 		/* word contains ruled-out letter */
-		if (0 != (know->exclude[i] & letter_bit(word->letters[i])))
+		if (0 != (know->exclude[i] & letter_bit(word_letter(word, i))))
 			return false;
 	}
 
-	for (int i = 0; i < sizeof(word->hist) / sizeof(word->hist[0]); ++i)
-		if ((word->hist[i] & know->hist[i]) != know->hist[i])
+	Histogram hist;
+	word_hist(word, hist);
+	for (int i = 0; i < sizeof(hist) / sizeof(hist[0]); ++i)
+		if ((hist[i] & know->hist[i]) != know->hist[i])
 			return false;
 
 	return true;
 }
 
 
-void
-filter_opts(const Know *know)
+int
+filter_opts(Game *g, const Know *know)
 {
 	if (know == NULL)
-		return;
+		return 0;
+
+	if (g->opt_planes.count != g->num_opts
+	 && planes_gather(&g->opt_planes, g->dict->words, g->opts, g->num_opts) < 0)
+		return -1;
+
+	uint64_t *mask = malloc(sizeof(uint64_t) * (planes_blocks(&g->opt_planes) + 1));
+	if (mask == NULL) {
+		fprintf(stderr, "out of memory\n");
+		return -1;
+	}
+
+	bool indexed = g->opt_index.sets != NULL && g->opt_index.alive_count == g->num_opts;
+	if (indexed)
+		bitindex_filter(&g->opt_index, know, mask);
+	else
+		planes_match(mask, &g->opt_planes, know);
 
 	int j = 0;
-	for (int i = 0; i < num_opts; ++i)
-		if (word_matches(&opts[i], know))
-			opts[j++] = opts[i];
+	for (int i = 0; i < g->num_opts; ++i)
+		if (mask[i / 64] & ((uint64_t)1 << (i % 64)))
+			g->opts[j++] = g->opts[i];
+
+	planes_compact(&g->opt_planes, mask);
+	free(mask);
+
+	g->num_opts = j;
 
-	num_opts = j;
+	/* filtering only clears bits in the index; start over once most
+	 * of them are gone */
+	if (indexed && g->opt_index.alive_count * 8 < g->opt_index.count)
+		bitindex_build(&g->opt_index, &g->opt_planes);
 
-	Word *new_opts = realloc(opts, num_opts * sizeof(Word));
-	if (new_opts != NULL || num_opts == 0)
-		opts = new_opts;
+	return 0;
 }
 
+static bool
+in_catalog(const Dict *d, int i, const uint64_t *match, const Know *know, int mask, int filter)
+{
+	if ((d->attrs[i].flags & mask) != filter)
+		return false;
+	if (match != NULL)
+		return match[i / 64] & ((uint64_t)1 << (i % 64));
+
+	return know == NULL || word_matches(&d->words[i], know);
+}
+
+/* Makes the words of the catalog that match know the options, without
+ * copying the ones that don't. Returns the size of the catalog. */
 static int
-load_opts(int mask, int filter)
+load_opts(Game *g, const Know *know, int mask, int filter)
 {
-	opts = realloc(opts, sizeof(Word) * num_words);
-	if (opts == NULL) {
-		fprintf(stderr, "out of memory\n");
-		return -1;
+	const Dict *d = g->dict;
+
+	uint64_t *match = NULL;
+	if (know != NULL && d->planes.count == d->num_words) {
+		match = malloc(sizeof(uint64_t) * (planes_blocks(&d->planes) + 1));
+		if (match == NULL) {
+			fprintf(stderr, "out of memory\n");
+			return -1;
+		}
+
+		planes_match(match, &d->planes, know);
 	}
 
-	num_opts = 0;
-	for (int i = 0; i < num_words; ++i)
-		if ((word_attrs[i].flags & mask) == filter)
-			opts[num_opts++] = all_words[i];
+	int size = 0, count = 0;
+	for (int i = 0; i < d->num_words; ++i) {
+		size += (d->attrs[i].flags & mask) == filter;
+		count += in_catalog(d, i, match, know, mask, filter);
+	}
 
-	return 0;
+	if (count > g->opt_capacity) {
+		int *opts = realloc(g->opts, sizeof(int) * count);
+		if (opts == NULL) {
+			fprintf(stderr, "out of memory\n");
+			free(match);
+			return -1;
+		}
+
+		g->opts = opts;
+		g->opt_capacity = count;
+	}
+
+	g->num_opts = 0;
+	for (int i = 0; i < d->num_words; ++i)
+		if (in_catalog(d, i, match, know, mask, filter))
+			g->opts[g->num_opts++] = i;
+	free(match);
+
+	if (planes_gather(&g->opt_planes, d->words, g->opts, g->num_opts) < 0
+	 || bitindex_build(&g->opt_index, &g->opt_planes) < 0)
+		return -1;
+
+	return size;
 }
 
 int
-update_opts(const Know *know)
+update_opts(Game *g, const Know *know)
 {
-	int slur_mask = suggest_slurs ? 0 : WA_SLUR;
-	if (opt_catalog == OC_NONE) {
-		if (load_opts(WA_TARGET | slur_mask, WA_TARGET) < 0)
+	int slur_mask = g->suggest_slurs ? 0 : WA_SLUR;
+	int prev_num_opts = g->num_opts;
+	if (g->opt_catalog == OC_NONE) {
+		prev_num_opts = load_opts(g, know, WA_TARGET | slur_mask, WA_TARGET);
+		if (prev_num_opts < 0)
 			return -1;
 
-		opt_catalog = OC_TARGET;
+		g->opt_catalog = OC_TARGET;
+	} else if (filter_opts(g, know) < 0) {
+		return -1;
 	}
 
-	int prev_num_opts = num_opts;
-	filter_opts(know);
-	int elim = prev_num_opts - num_opts;
+	int elim = prev_num_opts - g->num_opts;
 
-	if (opt_catalog == OC_TARGET && num_opts == 0) {
-		if (load_opts(slur_mask, 0) < 0)
+	if (g->opt_catalog == OC_TARGET && g->num_opts == 0) {
+		if (load_opts(g, know, slur_mask, 0) < 0)
 			return -1;
 
-		opt_catalog = OC_ALL;
-		filter_opts(know);
+		g->opt_catalog = OC_ALL;
 	}
 
 	return elim;
 }
 
+int
+reset_opts(Game *g, const Know *know)
+{
+	g->opt_catalog = OC_NONE;
+	return update_opts(g, know) < 0 ? -1 : 0;
+}
+
 bool
 all_green(WordColor wc)
 {
@@ -403,23 +572,32 @@ compare_to_target(WordColor out, const Word *guess, const Word *target)
 	int8_t target_hist[32] = { 0 };
 
 	for (int i = 0; i < 5; ++i)
-		if (guess->letters[i] != target->letters[i])
-			++target_hist[target->letters[i] - 'A'];
+		if (word_code(guess, i) != word_code(target, i))
+			++target_hist[word_code(target, i)];
 
 	for (int i = 0; i < 5; ++i) {
 		uint8_t color = DARK_COLOR;
+		int l = word_code(guess, i);
 
-		if (guess->letters[i] == target->letters[i]) {
+		if (l == word_code(target, i)) {
 			color = GREEN_COLOR;
-		} else if (target_hist[guess->letters[i] - 'A'] > 0) {
+		} else if (target_hist[l] > 0) {
 			color = YELLOW_COLOR;
-			--target_hist[guess->letters[i] - 'A'];
+			--target_hist[l];
 		}
 
 		out[i] = color;
 	}
 }
 
+uint8_t
+word_pattern(const Word *guess, const Word *target)
+{
+	WordColor wc;
+	compare_to_target(wc, guess, target);
+	return wc[0] + 3 * (wc[1] + 3 * (wc[2] + 3 * (wc[3] + 3 * wc[4])));
+}
+
 int
 knowledge_from_colors(Know *know, const Word *guess, WordColor colors)
 {
@@ -427,7 +605,7 @@ knowledge_from_colors(Know *know, const Word *guess, WordColor colors)
 	Histogram yellow = { 0 };
 
 	for (int i = 0; i < 5; ++i) {
-		char letter = guess->letters[i];
+		char letter = word_letter(guess, i);
 		switch (colors[i]) {
 		case GREEN_COLOR:
 			hist_add_letter(know->hist, letter);
@@ -447,12 +625,12 @@ knowledge_from_colors(Know *know, const Word *guess, WordColor colors)
 	}
 
 	for (int i = 0; i < 5; ++i) {
-		char letter = guess->letters[i];
+		char letter = word_letter(guess, i);
 		if (colors[i] != DARK_COLOR || hist_count(yellow, letter) > 0)
 			continue;
 
 		for (int j = 0; j < 5; ++j)
-			if (guess->letters[j] != letter)
+			if (word_letter(guess, j) != letter)
 				know->exclude[j] |= letter_bit(letter);
 	}
 
@@ -472,25 +650,25 @@ absorb_knowledge(Know *restrict know, const Know *other)
 }
 
 void
-print_wordch(FILE *f, char ch, char nxt)
+print_wordch(const Dict *d, FILE *f, char ch, char nxt)
 {
 	if (ch > 'Z') {
 		int dgidx = ch - 'Z' - 1;
-		if (dgidx >= num_digraphs) {
+		if (dgidx >= d->num_digraphs) {
 			fprintf(stderr, "invalid digraph %02x\n", (int)ch);
 			fputc('?', f);
 			return;
 		}
 
-		Digraph di = digraphs[dgidx];
+		Digraph di = d->digraphs[dgidx];
 		fputc(di.fst, f);
 		fputc(di.snd, f);
 		return;
 	}
 
 	fputc(ch, f);
-	for (int j = 0; j < num_digraphs; ++j) {
-		if (ch == digraphs[j].fst && nxt == digraphs[j].snd) {
+	for (int j = 0; j < d->num_digraphs; ++j) {
+		if (ch == d->digraphs[j].fst && nxt == d->digraphs[j].snd) {
 			fputc('-', f);
 			break;
 		}
@@ -498,11 +676,11 @@ print_wordch(FILE *f, char ch, char nxt)
 }
 
 void
-print_word(FILE *f, const Word *word)
+print_word(const Dict *d, FILE *f, const Word *word)
 {
 	for (int i = 0; i < 4; ++i)
-		print_wordch(f, word->letters[i], word->letters[i + 1]);
-	print_wordch(f, word->letters[4], 0);
+		print_wordch(d, f, word_letter(word, i), word_letter(word, i + 1));
+	print_wordch(d, f, word_letter(word, 4), 0);
 }
 
 void
@@ -0,0 +1,223 @@
+/*
+ * Make word1e decision tree.
+ * Copyright (C) 2023  Antonie Blom
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <game.h>
+#include <tree.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *index_path = "words-index.txt", *out_path;
+static int num_openers = 1;
+static enum tree_policy policy = TP_GREEDY;
+static enum optimal_objective objective = OO_EXPECTED;
+static int width = 0;
+static char *cmd;
+
+static Dict dict;
+static Game game;
+
+static void
+print_usage(void)
+{
+	printf("Usage: %s [OPTION]... [INDEX]\n"
+	       "Make Wordle-solver decision tree from index.\n\n"
+	       "Options:\n"
+	       "  -n COUNT              Expand the first COUNT opening words.\n"
+	       "  -o PATH               Output tree.\n"
+	       "  -v                    Verbose output.\n"
+	       "  -w WIDTH              Try only the best WIDTH guesses per state\n"
+	       "                        with --optimal or --worst. Faster, but the\n"
+	       "                        tree is then a heuristic one, not\n"
+	       "                        necessarily optimal (default: all).\n"
+	       "  --optimal             Play optimally for the fewest guesses on\n"
+	       "                        average instead of greedily.\n"
+	       "  --worst               Play optimally for the fewest guesses in\n"
+	       "                        the worst case.\n"
+	       "  --help                Show this message.\n\n", cmd);
+}
+
+static int
+handle_value_option(int *arg_idx,
+                    int argc,
+                    char **argv,
+                    const char *opt_name,
+                    const char **target)
+{
+	if (argc <= *arg_idx + 1) {
+		fprintf(stderr, "expected argument after %s\n", opt_name);
+		print_usage();
+		return -1;
+	}
+
+	*target = argv[++*arg_idx];
+	return 0;
+}
+
+static int
+handle_string_option(const char *arg, int *arg_idx, int argc, char **argv)
+{
+	if (0 == strcmp(arg, "--help")) {
+		print_usage();
+		exit(0);
+	}
+	if (0 == strcmp(arg, "--optimal")) {
+		policy = TP_OPTIMAL;
+		objective = OO_EXPECTED;
+		return 0;
+	}
+	if (0 == strcmp(arg, "--worst")) {
+		policy = TP_OPTIMAL;
+		objective = OO_WORST;
+		return 0;
+	}
+
+	fprintf(stderr, "unknown option `%s'\n", arg);
+	return -1;
+}
+static int
+handle_option(char opt, int *arg_idx, int argc, char **argv)
+{
+	const char *count;
+
+	switch (opt) {
+	case 'v':
+		++verbosity;
+		break;
+	case 'o':
+		return handle_value_option(arg_idx, argc, argv, "-o", &out_path);
+	case 'n':
+		if (handle_value_option(arg_idx, argc, argv, "-n", &count) < 0)
+			return -1;
+
+		num_openers = atoi(count);
+		if (num_openers < 1) {
+			fprintf(stderr, "expected positive count after -n\n");
+			return -1;
+		}
+		break;
+	case 'w':
+		if (handle_value_option(arg_idx, argc, argv, "-w", &count) < 0)
+			return -1;
+
+		width = atoi(count);
+		if (width < 0) {
+			fprintf(stderr, "expected non-negative width after -w\n");
+			return -1;
+		}
+		break;
+	default:
+		fprintf(stderr, "unknown option '%c'\n", opt);
+		print_usage();
+		return -1;
+	}
+	return 0;
+}
+static int
+handle_arg(const char *arg, int *arg_idx, int argc, char **argv)
+{
+	if (arg[0] != '-') {
+		index_path = arg;
+		return 0;
+	}
+
+	if (arg[1] == '-')
+		return handle_string_option(arg, arg_idx, argc, argv);
+
+	for (int i = 1; arg[i]; ++i)
+		if (handle_option(arg[i], arg_idx, argc, argv))
+			return -1;
+
+	return 0;
+}
+static int
+handle_args(int argc, char **argv)
+{
+	cmd = argv[0];
+
+	for (int i = 1; i < argc; ++i)
+		if (handle_arg(argv[i], &i, argc, argv))
+			return -1;
+
+	return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+	if (handle_args(argc, argv) < 0)
+		exit(1);
+
+	FILE *f = fopen(index_path, "rb");
+	if (f == NULL) {
+		perror(index_path);
+		exit(1);
+	}
+
+	if (load_index(&dict, f) < 0 || game_init(&game, &dict) < 0)
+		exit(1);
+
+	fclose(f);
+
+	game.optimal_objective = objective;
+	game.optimal_width = width;
+
+	fprintf(stderr, "expanding %d opening word(s)...\n", num_openers);
+
+	DecisionTree tree;
+	if (tree_build(&tree, &game, num_openers, policy) < 0)
+		exit(1);
+
+	fprintf(stderr, "%u nodes, %u edges\n", tree.num_nodes, tree.num_edges);
+
+	if (policy == TP_OPTIMAL) {
+		int guess;
+		long cost = optimal_guess(&game, game.opts, game.num_opts, &guess);
+		if (cost < 0)
+			exit(1);
+		if (objective == OO_WORST)
+			fprintf(stderr, "at most %ld guesses", cost);
+		else
+			fprintf(stderr, "%.4f guesses on average", (double)cost / game.num_opts);
+
+		if (width > 0)
+			fprintf(stderr, " (heuristic, trying %d guesses per state)\n", width);
+		else
+			fprintf(stderr, " (optimal)\n");
+	}
+
+	FILE *fout = stdout;
+	if (out_path) {
+		fout = fopen(out_path, "wb");
+		if (!fout) {
+			perror(cmd);
+			exit(1);
+		}
+	}
+
+	int rc = tree_save(&tree, &dict, fout);
+
+	if (out_path)
+		fclose(fout);
+
+	tree_free(&tree);
+	game_free(&game);
+	dict_free(&dict);
+	return (rc < 0) ? 1 : 0;
+}
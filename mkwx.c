@@ -17,7 +17,9 @@
  * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
 
-#include <score.h>
+#include <binindex.h>
+#include <game.h>
+#include <second.h>
 #include <threadpool.h>
 #include <ctype.h>
 #include <pthread.h>
@@ -28,7 +30,8 @@
 
 typedef struct {
 	Word *guess;
-	WordAttr attr;
+	double score;
+	int flags;
 } InitialGuess;
 
 static InitialGuess *output;
@@ -39,17 +42,23 @@ typedef struct {
 
 static const char *word_list, *target_path, *slur_path, *out_path;
 static char *cmd;
+static bool binary;
 
 static Word *slurs;
 static int num_slurs;
 
+static Dict dict;
+
+/* the game's options are the targets */
+static Dict targets;
+static Game game;
+
 static int
 ig_compar(const void *lptr, const void *rptr)
 {
 	InitialGuess l = *(InitialGuess *)lptr;
 	InitialGuess r = *(InitialGuess *)rptr;
-	return (l.attr.starting_score < r.attr.starting_score)
-	     - (l.attr.starting_score > r.attr.starting_score);
+	return (l.score < r.score) - (l.score > r.score);
 }
 
 static int
@@ -58,12 +67,8 @@ w_compar(const void *lptr, const void *rptr)
 	Word l = *(Word *)lptr;
 	Word r = *(Word *)rptr;
 
-	char lbuf[6], rbuf[6];
-	memcpy(lbuf, l.letters, 5);
-	memcpy(rbuf, r.letters, 5);
-	lbuf[5] = rbuf[5] = '\0';
-
-	return strcmp(lbuf, rbuf);
+	/* packed words sort alphabetically */
+	return (l.packed > r.packed) - (l.packed < r.packed);
 }
 
 static int
@@ -71,8 +76,8 @@ calc_attrs(const Word *word)
 {
 	int res = 0;
 
-	/* requires opts be alphabetically sorted (which it should be) */
-	if (bsearch(word, opts, num_opts, sizeof(Word), w_compar))
+	/* requires targets be alphabetically sorted (which they should be) */
+	if (bsearch(word, targets.words, targets.num_words, sizeof(Word), w_compar))
 		res |= WA_TARGET;
 	if (bsearch(word, slurs, num_slurs, sizeof(Word), w_compar))
 		res |= WA_SLUR;
@@ -91,18 +96,18 @@ build_index(void *info)
 	Know k = { 0 };
 	for (int i = from; i < until; ++i) {
 		InitialGuess *ig = output + i;
-		ig->guess = &all_words[i];
-		ig->attr.starting_score = score_guess_st(&all_words[i], NULL, &k, 0.0);
+		ig->guess = &dict.words[i];
+		ig->score = score_guess_st(&game, &dict.words[i], NULL, &k, 0.0);
 		if (verbosity > 0) {
-			int iscore = ig->attr.starting_score * 1000000.0;
-			print_word(stderr, ig->guess);
+			int iscore = ig->score * ATTR_SCORE_ONE;
+			print_word(&dict, stderr, ig->guess);
 
 			/* spaces are so simultaneous writes don't
 			 * leave permanent marks. */
-			fprintf(stderr, " 0.%06d [%5d / %5d]        \r", iscore, ++progress, num_words);
+			fprintf(stderr, " 0.%06d [%5d / %5d]        \r", iscore, ++progress, dict.num_words);
 		}
 
-		ig->attr.flags = calc_attrs(ig->guess);
+		ig->flags = calc_attrs(ig->guess);
 	}
 }
 
@@ -122,34 +127,80 @@ print_attrs(FILE *fout, int attr)
 		fputc('s', fout);
 }
 
+/* Makes the sorted output the library's index, as if it were loaded. */
+static void
+install_index(void)
+{
+	int num_words = dict.num_words;
+	Word *words = malloc(sizeof(Word) * num_words);
+	WordAttr *attrs = malloc(sizeof(WordAttr) * num_words);
+	if (words == NULL || attrs == NULL) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+
+	for (int i = 0; i < num_words; ++i) {
+		words[i] = *output[i].guess;
+		attrs[i].starting_score = output[i].score * ATTR_SCORE_ONE;
+		attrs[i].flags = output[i].flags;
+	}
+
+	free(output);
+	free(dict.words);
+	game_free(&game);
+	dict_free(&targets);
+
+	dict.words = words;
+	dict.attrs = attrs;
+
+	if (init_index(&dict) < 0)
+		exit(1);
+}
+
+static void
+write_text_index(FILE *fout)
+{
+	fprintf(fout, "%d\n", dict.num_words);
+	for (int i = 0; i < dict.num_digraphs; ++i)
+		fprintf(fout, "#DIGRAPH %c%c\n", dict.digraphs[i].fst, dict.digraphs[i].snd);
+
+	for (int i = 0; i < dict.num_words; ++i) {
+		print_word(&dict, fout, &dict.words[i]);
+		fprintf(fout, " 0.%06d", (int)dict.attrs[i].starting_score);
+		print_attrs(fout, dict.attrs[i].flags);
+		fputc('\n', fout);
+	}
+
+	write_second_guesses(&dict, fout);
+}
+
 static void
 compile_index(void)
 {
 	fprintf(stderr, "sorting output...");
-	qsort(output, num_words, sizeof(InitialGuess), ig_compar);
+	qsort(output, dict.num_words, sizeof(InitialGuess), ig_compar);
+	install_index();
+	fprintf(stderr, " done!\n");
+
+	fprintf(stderr, "finding second guesses...");
+	if (compute_second_guesses(&dict) < 0)
+		exit(1);
 	fprintf(stderr, " done!\n");
 
 	fprintf(stderr, "writing output...");
 	FILE *fout = stdout;
 	if (out_path) {
-		fout = fopen(out_path, "w");
+		fout = fopen(out_path, binary ? "wb" : "w");
 		if (!fout) {
 			perror(cmd);
 			exit(1);
 		}
 	}
 
-	fprintf(fout, "%d\n", num_words);
-	for (int i = 0; i < num_digraphs; ++i)
-		fprintf(fout, "#DIGRAPH %c%c\n", digraphs[i].fst, digraphs[i].snd);
-
-	for (int i = 0; i < num_words; ++i) {
-		int iscore = output[i].attr.starting_score * 1000000.0;
-		print_word(fout, output[i].guess);
-		fprintf(fout, " 0.%06d", iscore);
-		print_attrs(fout, output[i].attr.flags);
-		fputc('\n', fout);
-	}
+	if (!binary)
+		write_text_index(fout);
+	else if (binindex_save(&dict, fout) < 0)
+		exit(1);
 
 	if (out_path)
 		fclose(fout);
@@ -167,6 +218,7 @@ print_usage(void)
 	       "  -v                    Verbose output.\n"
 	       "  --target PATH         Path to file of possible target words.\n"
 	       "  --slur PATH           Path to file of slurs.\n"
+	       "  --binary              Output a binary index, for mapping.\n"
 	       "  --help                Show this message.\n\n", cmd);
 }
 
@@ -201,6 +253,11 @@ handle_string_option(const char *arg, int *arg_idx, int argc, char **argv)
 	if (0 == strcmp(arg, "--slur"))
 		return handle_path_option(arg_idx, argc, argv, "--slur", &slur_path);
 
+	if (0 == strcmp(arg, "--binary")) {
+		binary = true;
+		return 0;
+	}
+
 	fprintf(stderr, "unknown option `%s'\n", arg);
 	return -1;
 }
@@ -267,7 +324,7 @@ read_word_list(void)
 		}
 	}
 
-	ssize_t snum_words = load_words(f, &all_words);
+	ssize_t snum_words = load_words(&dict, f, &dict.words);
 
 	if (word_list)
 		fclose(f);
@@ -275,7 +332,21 @@ read_word_list(void)
 	if (snum_words < 0)
 		exit(1);
 
-	num_words = snum_words;
+	dict.num_words = snum_words;
+}
+
+/* Makes every target an option. */
+static void
+mark_targets(void)
+{
+	targets.attrs = calloc(targets.num_words + 1, sizeof(WordAttr));
+	if (targets.attrs == NULL) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+
+	for (int i = 0; i < targets.num_words; ++i)
+		targets.attrs[i].flags = WA_TARGET;
 }
 
 static void
@@ -291,7 +362,7 @@ read_special_list(Word **list, int *count, Word *fb, int num_fb, const char *pat
 			exit(1);
 		}
 
-		ssize_t snum_words = load_words(f, list);
+		ssize_t snum_words = load_words(&dict, f, list);
 
 		fclose(f);
 
@@ -319,40 +390,40 @@ main(int argc, char **argv)
 	if (handle_args(argc, argv) < 0)
 		exit(1);
 
+	dict_init(&dict);
+	dict_init(&targets);
 	read_word_list();
 
-	/* opts will be alphabetically sorted */
-	read_special_list(&opts, &num_opts, all_words, num_words, target_path);
+	/* targets will be alphabetically sorted */
+	read_special_list(&targets.words, &targets.num_words, dict.words, dict.num_words, target_path);
 	read_special_list(&slurs, &num_slurs, NULL, 0, slur_path);
+	mark_targets();
+	if (game_init(&game, &targets) < 0)
+		exit(1);
 
 	Range ranges[8];
 	int last_word = 0;
 	for (int i = 0; i < 8; ++i) {
 		ranges[i].from = last_word;
-		last_word += (num_words - last_word) / (8 - i);
+		last_word += (dict.num_words - last_word) / (8 - i);
 		ranges[i].until = last_word;
 
 		fprintf(stderr, "task %d handling ", i);
-		print_word(stderr, &all_words[ranges[i].from]);
+		print_word(&dict, stderr, &dict.words[ranges[i].from]);
 		fprintf(stderr, "..");
-		print_word(stderr, &all_words[last_word - 1]);
+		print_word(&dict, stderr, &dict.words[last_word - 1]);
 		fprintf(stderr, "\n");
 	}
 
-	output = malloc(sizeof(InitialGuess) * num_words);
-
-	size_t nthread = 8, nqueue = 16;
-	threadpool_t *pool = threadpool_create(nthread, nqueue, 0);
-	for (int i = 0; i < 8; ++i)
-		threadpool_add(pool, build_index, &ranges[i], 0);
+	output = malloc(sizeof(InitialGuess) * dict.num_words);
 
-	threadpool_destroy(pool, THREADPOOL_GRACEFUL);
+	threadpool_run(score_pool(), build_index, ranges, 8, sizeof(ranges[0]));
 	fprintf(stderr, "\ntasks done!\n");
 
 	compile_index();
 
-	free(all_words);
-	free(opts);
+	game_free(&game);
+	dict_free(&dict);
 	free(slurs);
 	return 0;
 }
@@ -25,10 +25,13 @@
 #include <string.h>
 #include <time.h>
 #include <unistd.h>
-#include <score.h>
+#include <game.h>
+#include <threadpool.h>
+#include <tree.h>
+#include "json.h"
 #include "word.h"
 
-static char *dict_path = "words-index.txt";
+static char *dict_path = "words-index.txt", *tree_path;
 static const char *target_str;
 
 static enum { FIXED_TARGET, PUZZLE_TARGET, RANDOM_TARGET, } target_mode = -1;
@@ -51,6 +54,19 @@ static enum { AUTO_COLOR, YES_COLOR, NO_COLOR } color = AUTO_COLOR;
 
 static Word target;
 
+static Dict dict;
+static Game game;
+static enum score_metric metric = MT_SQUARES;
+static ScoreStats stats; /* collected with -v */
+
+/* number of targets to play with --bench (0 for all of them), or -1 */
+static int bench_games = -1;
+static unsigned bench_seed = 1;
+
+/* node of the current state, or -1 if not in the tree */
+static DecisionTree tree;
+static int tree_node = -1;
+
 typedef struct {
 	Word guess;
 	double score;
@@ -60,10 +76,10 @@ typedef Know (*Oracle)(const Word *guess, WordColor colors);
 typedef bool (*Guesser)(const Know *k, GuessReport *guess, GuessReport **best, int *num_best);
 
 static void
-load_target(char *target_str)
+load_target(const char *target_str)
 {
 	FILE *f = fmemopen((void *)target_str, strlen(target_str), "r");
-	if (scan_word(f, &target) < 0) {
+	if (scan_word(&dict, f, &target) < 0) {
 		fprintf(stderr, "invalid word given\n");
 		exit(1);
 	}
@@ -77,7 +93,7 @@ print_opt(int i, int cols, int count, Word word)
 	if ((i % cols) == 0)
 		putchar(' ');
 	putchar(' ');
-	print_word(stdout, &word);
+	print_word(&dict, stdout, &word);
 	if ((i % cols) == (cols - 1) || i == count - 1)
 		putchar('\n');
 }
@@ -85,12 +101,12 @@ print_opt(int i, int cols, int count, Word word)
 static void
 print_opts(int cols, int count)
 {
-	if (num_opts <= count) {
-		for (int i = 0; i < num_opts; ++i)
-			print_opt(i, cols, num_opts, opts[i]);
+	if (game.num_opts <= count) {
+		for (int i = 0; i < game.num_opts; ++i)
+			print_opt(i, cols, game.num_opts, *opt_word(&game, i));
 	} else {
 		for (int i = 0; i + 1 < count; ++i)
-			print_opt(i, cols, count, opts[i]);
+			print_opt(i, cols, count, *opt_word(&game, i));
 		printf(" ...\n");
 	}
 }
@@ -100,7 +116,7 @@ print_guesses(Word *top, int max, int n, double score)
 {
 	int m = (n < max) ? n : max;
 	for (int i = 0; i < m; ++i) {
-		print_word(stdout, &top[i]);
+		print_word(&dict, stdout, &top[i]);
 		if (i == m - 1) {
 			if (n > m)
 				printf("... +%d", n - m);
@@ -109,7 +125,7 @@ print_guesses(Word *top, int max, int n, double score)
 		}
 	}
 
-	double exp_opts = num_opts * (1.0 - score);
+	double exp_opts = game.num_opts * (1.0 - score);
 	printf(" (score %.1f%%, exp %.2f)\n", score * 100.0, exp_opts);
 }
 
@@ -120,7 +136,11 @@ best_reports(const Know *know, GuessReport **best, int *num_best)
 	Word *top_words = malloc(sizeof(Word) * max_top_guesses);
 
 	int n;
-	double best_score = best_guesses(top_words, max_top_guesses, &n, know);
+	double best_score;
+	if (tree_node >= 0)
+		best_score = tree_best(&tree, &dict, tree_node, top_words, max_top_guesses, &n);
+	else
+		best_score = best_guesses(&game, top_words, max_top_guesses, &n, know);
 
 	int m = (n < max_top_guesses) ? n : max_top_guesses;
 	GuessReport *reports = malloc(sizeof(GuessReport) * m);
@@ -141,10 +161,10 @@ bot_guesser(const Know *know, GuessReport *guess, GuessReport **best, int *num_b
 	best_reports(know, best, num_best);
 
 	if (has_no_knowledge(know) && initial_options > 1) {
-		int mod = (initial_options > num_words) ? num_words : initial_options;
+		int mod = (initial_options > dict.num_words) ? dict.num_words : initial_options;
 		int idx = rand() % mod;
-		memcpy(&guess->guess, &all_words[idx], sizeof(Word));
-		guess->score = word_attrs[idx].starting_score;
+		memcpy(&guess->guess, &dict.words[idx], sizeof(Word));
+		guess->score = attr_score(&dict.attrs[idx]);
 	} else {
 		*guess = (*best)[0];
 	}
@@ -168,7 +188,7 @@ user_guesser(const Know *k, GuessReport *guess, GuessReport **best, int *num_bes
 		if (should_prompt)
 			printf("> ");
 
-		if (scan_word(stdin, &word) == 0) {
+		if (scan_word(&dict, stdin, &word) == 0) {
 			// flush newline
 			int ch;
 			while ((ch = getchar()) != '\n')
@@ -182,7 +202,7 @@ user_guesser(const Know *k, GuessReport *guess, GuessReport **best, int *num_bes
 	best_reports(k, best, num_best);
 
 	memcpy(&guess->guess, &word, sizeof(Word));
-	guess->score = score_guess(&word, k);
+	guess->score = score_guess(&game, &word, k);
 	return true;
 
 	/*
@@ -220,7 +240,7 @@ print_playing(const Word *guess, WordColor colors)
 			}
 		}
 
-		print_wordch(stdout, guess->letters[i], (i < 4) ? guess->letters[i + 1] : 0);
+		print_wordch(&dict, stdout, word_letter(guess, i), (i < 4) ? word_letter(guess, i + 1) : 0);
 
 		if (color == YES_COLOR)
 			printf("\e[0m");
@@ -308,7 +328,7 @@ static Know
 puzzle_target_oracle(const Word *guess, WordColor wc_out)
 {
 	printf("Play ");
-	print_word(stdout, guess);
+	print_word(&dict, stdout, guess);
 	puts(".");
 
 	WordColor wc;
@@ -326,7 +346,7 @@ print_opts_left()
 	if (verbosity <= -1)
 		return;
 
-	printf("options left: %d\n", num_opts);
+	printf("options left: %d\n", game.num_opts);
 	print_opts(4, 20);
 }
 
@@ -334,7 +354,7 @@ static void
 run(Guesser guesser, Oracle oracle, Know k)
 {
 	int guess_count = 0;
-	while (num_opts > 0) {
+	while (game.num_opts > 0) {
 		GuessReport guess, *best = NULL;
 		int num_best = 0;
 
@@ -353,12 +373,20 @@ run(Guesser guesser, Oracle oracle, Know k)
 		Know new = oracle(&guess.guess, wc);
 		absorb_knowledge(&k, &new);
 
-		int elim = update_opts(&k);
+		if (tree_node >= 0)
+			tree_node = tree_child(&tree, tree_node, index_of_word(&dict, &guess.guess), wc);
+
+		int elim = update_opts(&game, &k);
 		if (elim < 0)
 			exit(1);
 
 		print_opts_left();
 
+		if (game.stats != NULL) {
+			score_stats_print(&stats, stdout);
+			score_stats_reset(&stats);
+		}
+
 		free(best);
 
 		if (all_green(wc))
@@ -366,32 +394,275 @@ run(Guesser guesser, Oracle oracle, Know k)
 	}
 
 	putchar('\n');
-	if (num_opts) {
+	if (game.num_opts) {
 		printf("Got ");
-		print_word(stdout, &target);
+		print_word(&dict, stdout, &target);
 		printf(" in %d guesses.\n", guess_count);
 	} else {
 		printf("Didn't get ");
-		print_word(stdout, &target);
+		print_word(&dict, stdout, &target);
 		printf(" in %d guesses.\n", guess_count);
 	}
 }
 
+#define BENCH_MAX_TURNS 32
+#define BENCH_MAX_GUESSES 6 /* more is a failure */
+
+typedef struct {
+	Word target;
+	int guesses;   /* 0 if never found */
+	int num_turns;
+	double turn_us[BENCH_MAX_TURNS];
+	bool error;
+} BenchGame;
+
+static double
+elapsed_us(const struct timespec *from, const struct timespec *to)
+{
+	return (to->tv_sec - from->tv_sec) * 1e6 + (to->tv_nsec - from->tv_nsec) / 1e3;
+}
+
+/* Plays one game the way bot_guesser would, without printing. A turn
+ * is picking the guess and taking in its feedback. */
+static void
+bench_worker(void *info)
+{
+	BenchGame *bg = info;
+
+	Know k = { 0 };
+	Game g;
+	if (game_init_from(&g, &game, &k) < 0) {
+		bg->error = true;
+		return;
+	}
+
+	Word top[1];
+	int node = (tree_path != NULL) ? 0 : -1;
+	while (g.num_opts > 0 && bg->num_turns < BENCH_MAX_TURNS) {
+		struct timespec start, end;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+
+		int n;
+		if (node >= 0)
+			tree_best(&tree, &dict, node, top, 1, &n);
+		else
+			best_guesses(&g, top, 1, &n, &k);
+
+		if (n <= 0)
+			break;
+
+		WordColor wc;
+		compare_to_target(wc, &top[0], &bg->target);
+
+		Know new;
+		knowledge_from_colors(&new, &top[0], wc);
+		absorb_knowledge(&k, &new);
+
+		if (node >= 0)
+			node = tree_child(&tree, node, index_of_word(&dict, &top[0]), wc);
+
+		if (update_opts(&g, &k) < 0) {
+			bg->error = true;
+			break;
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		bg->turn_us[bg->num_turns++] = elapsed_us(&start, &end);
+
+		if (all_green(wc)) {
+			bg->guesses = bg->num_turns;
+			break;
+		}
+	}
+
+	game_free(&g);
+}
+
+static int
+compare_doubles(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+/* Nearest-rank percentile of sorted values. */
+static double
+percentile(const double *sorted, int n, int p)
+{
+	if (n == 0)
+		return 0.0;
+
+	int rank = (n * p + 99) / 100;
+	return sorted[(rank > 0) ? rank - 1 : 0];
+}
+
+static void
+report_bench(JSONWriter *json, const BenchGame *games, int n, double seconds)
+{
+	int hist[BENCH_MAX_TURNS + 1] = { 0 }, max_guesses = 0;
+	int failures = 0, num_turns = 0, solved = 0;
+	long solved_guesses = 0;
+	for (int i = 0; i < n; ++i) {
+		int guesses = games[i].guesses;
+		++hist[guesses];
+		if (guesses > max_guesses)
+			max_guesses = guesses;
+		if (guesses == 0 || guesses > BENCH_MAX_GUESSES)
+			++failures;
+		if (guesses > 0) {
+			++solved;
+			solved_guesses += guesses;
+		}
+
+		num_turns += games[i].num_turns;
+	}
+
+	double *turns = malloc(sizeof(double) * (num_turns + 1));
+	if (turns == NULL) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+
+	int k = 0;
+	for (int i = 0; i < n; ++i)
+		for (int j = 0; j < games[i].num_turns; ++j)
+			turns[k++] = games[i].turn_us[j];
+	qsort(turns, num_turns, sizeof(double), compare_doubles);
+
+	json_enter_dict(json);
+
+	json_enter_assoc(json, "metric");
+	json_string(json, (tree_path != NULL) ? "tree" : score_metric_name(game.score_metric));
+	json_leave_assoc(json);
+
+	json_enter_assoc(json, "games");
+	json_int(json, n);
+	json_leave_assoc(json);
+
+	json_enter_assoc(json, "failures");
+	json_int(json, failures);
+	json_leave_assoc(json);
+
+	/* over the games that found their target, however late */
+	json_enter_assoc(json, "meanGuesses");
+	json_double(json, solved ? (double)solved_guesses / solved : 0.0);
+	json_leave_assoc(json);
+
+	/* games found in 1, 2, ... guesses; unfound ones only count as
+	 * failures */
+	json_enter_assoc(json, "guesses");
+	json_enter_list(json);
+	for (int i = 1; i <= max_guesses; ++i)
+		json_int(json, hist[i]);
+	json_leave_list(json);
+	json_leave_assoc(json);
+
+	json_enter_assoc(json, "turnMicros");
+	json_enter_dict(json);
+	static const int percentiles[] = { 50, 95, 99 };
+	for (int i = 0; i < 3; ++i) {
+		char key[8];
+		snprintf(key, sizeof(key), "p%d", percentiles[i]);
+		json_enter_assoc(json, key);
+		json_double(json, percentile(turns, num_turns, percentiles[i]));
+		json_leave_assoc(json);
+	}
+	json_enter_assoc(json, "max");
+	json_double(json, num_turns ? turns[num_turns - 1] : 0.0);
+	json_leave_assoc(json);
+	json_leave_dict(json);
+	json_leave_assoc(json);
+
+	json_enter_assoc(json, "seconds");
+	json_double(json, seconds);
+	json_leave_assoc(json);
+
+	json_enter_assoc(json, "gamesPerSecond");
+	json_double(json, (seconds > 0.0) ? n / seconds : 0.0);
+	json_leave_assoc(json);
+
+	json_leave_dict(json);
+	free(turns);
+}
+
+/* Plays every target (or a sample of bench_games of them) at once and
+ * prints how it went as JSON. */
+static int
+run_bench(void)
+{
+	int n = game.num_opts;
+	if (bench_games > 0 && bench_games < n)
+		n = bench_games;
+
+	int *order = malloc(sizeof(int) * (game.num_opts + 1));
+	BenchGame *games = calloc(n + 1, sizeof(BenchGame));
+	if (order == NULL || games == NULL) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+
+	/* the first n of a seeded shuffle */
+	for (int i = 0; i < game.num_opts; ++i)
+		order[i] = i;
+	if (n < game.num_opts) {
+		srand(bench_seed);
+		for (int i = game.num_opts - 1; i > 0; --i) {
+			int j = rand() % (i + 1), t = order[i];
+			order[i] = order[j];
+			order[j] = t;
+		}
+	}
+
+	for (int i = 0; i < n; ++i)
+		games[i].target = *opt_word(&game, order[i]);
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	threadpool_run(score_pool(), bench_worker, games, n, sizeof(games[0]));
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	int rc = 0;
+	for (int i = 0; i < n; ++i)
+		if (games[i].error)
+			rc = 1;
+
+	if (rc == 0) {
+		JSONWriter json;
+		json_writer_init(&json, stdout);
+		report_bench(&json, games, n, elapsed_us(&start, &end) / 1e6);
+		putchar('\n');
+		json_writer_destroy(&json);
+
+		if (game.stats != NULL)
+			score_stats_print(&stats, stderr);
+	}
+
+	free(games);
+	free(order);
+	return rc;
+}
+
 static void
 print_usage(void)
 {
 	static const char usage[] =
 		"Usage: ./word1e-solve [OPTION]... WORD\n\n"
 		"Options:\n"
+		"  --bench[=COUNT]       Play every target word (or COUNT sampled\n"
+		"                        ones) and print statistics as JSON.\n"
 		"  -c                    Coaching mode.\n"
 		"  --color=<auto|yes|no> Enable/disable coloor.\n"
 		"  --help                Show this message.\n"
 		"  -i PATH               Use index file at PATH.\n"
 		"  -j                    JSON output.\n"
+		"  --metric=NAME         Rank guesses by squares (default), entropy,\n"
+		"                        expected, max or buckets.\n"
 		"  -q                    Quiet output.\n"
 		"  -r                    Select random word.\n"
 		"  -s                    Keep the target word a secret.\n"
-		"  -v                    Verbose output.\n"
+		"  --seed=SEED           Sample the targets of --bench with SEED.\n"
+		"  -t PATH               Play from decision tree at PATH.\n"
+		"  -v                    Verbose output, with scoring statistics.\n"
 		"  -x                    Extended initial word selection.\n";
 
 	puts(usage);
@@ -417,6 +688,32 @@ handle_string_option(const char *arg, int *arg_idx, int argc, char **argv)
 		color = NO_COLOR;
 		return 0;
 	}
+	if (0 == strcmp(arg, "--bench")) {
+		bench_games = 0;
+		return 0;
+	}
+	if (0 == strncmp(arg, "--bench=", 8)) {
+		bench_games = atoi(arg + 8);
+		if (bench_games <= 0) {
+			fprintf(stderr, "expected positive count after --bench=\n");
+			return -1;
+		}
+		return 0;
+	}
+	if (0 == strncmp(arg, "--seed=", 7)) {
+		bench_seed = strtoul(arg + 7, NULL, 10);
+		return 0;
+	}
+	if (0 == strncmp(arg, "--metric=", 9)) {
+		int m = score_metric_from_name(arg + 9);
+		if (m < 0) {
+			fprintf(stderr, "unknown metric `%s'\n", arg + 9);
+			return -1;
+		}
+
+		metric = m;
+		return 0;
+	}
 
 	fprintf(stderr, "unknown option `%s'\n", arg);
 	return -1;
@@ -452,6 +749,15 @@ handle_option(char opt, int *arg_idx, int argc, char **argv)
 
 		dict_path = argv[++*arg_idx];
 		break;
+	case 't':
+		if (argc <= *arg_idx + 1) {
+			fprintf(stderr, "expected argument after -t\n");
+			print_usage();
+			return -1;
+		}
+
+		tree_path = argv[++*arg_idx];
+		break;
 	default:
 		fprintf(stderr, "unknown option '%c'\n", opt);
 		print_usage();
@@ -463,8 +769,9 @@ static int
 handle_arg(const char *arg, int *arg_idx, int argc, char **argv)
 {
 	if (arg[0] != '-') {
+		/* scanned once the index has told us its digraphs */
 		set_mode((int *)&target_mode, FIXED_TARGET);
-		load_target((char *)arg);
+		target_str = arg;
 		return 0;
 	}
 
@@ -508,14 +815,42 @@ main(int argc, char **argv)
 		exit(1);
 	}
 
-	if (load_index(f) < 0)
+	if (load_index(&dict, f) < 0 || game_init(&game, &dict) < 0)
 		exit(1);
 
 	fclose(f);
 
+	game.score_metric = metric;
+	if (verbosity > 0)
+		game.stats = &stats;
+	if (target_str != NULL)
+		load_target(target_str);
+
+	if (tree_path != NULL) {
+		f = fopen(tree_path, "rb");
+		if (f == NULL) {
+			perror(tree_path);
+			exit(1);
+		}
+
+		if (tree_load(&tree, &dict, f) < 0)
+			exit(1);
+
+		fclose(f);
+		tree_node = 0;
+	}
+
+	if (bench_games >= 0) {
+		int rc = run_bench();
+		tree_free(&tree);
+		game_free(&game);
+		dict_free(&dict);
+		return rc;
+	}
+
 	if (target_mode == RANDOM_TARGET) {
-		int idx = random() % num_opts;
-		memcpy(&target, &opts[idx], sizeof(Word));
+		int idx = random() % game.num_opts;
+		target = *opt_word(&game, idx);
 		target_mode = FIXED_TARGET;
 	}
 
@@ -548,5 +883,9 @@ main(int argc, char **argv)
 	}
 
 	run(guesser, oracle, k_init);
+
+	tree_free(&tree);
+	game_free(&game);
+	dict_free(&dict);
 	return 0;
 }
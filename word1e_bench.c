@@ -0,0 +1,633 @@
+/*
+ * Word1e kernel benchmarks.
+ * Copyright (C) 2023  Antonie Blom
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <cache.h>
+#include <game.h>
+#include <planes.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "json.h"
+
+#define NUM_PAIRS  4096 /* guess, target pairs */
+#define NUM_STATES 16   /* knowledge states after two guesses */
+
+static const char *index_path, *baseline_path, *only;
+static int synthetic_words = 4000, reps = 20, warmup = 3;
+static double threshold = 10.0; /* percent slower that counts as a regression */
+static unsigned seed = 1;
+static char *cmd;
+
+static Dict dict;
+static Game game;
+
+static struct {
+	int guess, target; /* dict indices */
+	WordColor colors;
+	Know know;
+} pairs[NUM_PAIRS];
+
+static Know state_know[NUM_STATES];
+static Game state_games[NUM_STATES];
+static Game filter_games[NUM_STATES];
+static Word *top;
+static uint8_t *codes; /* planes_patterns output for the options */
+
+static volatile long sink;
+
+/* Each rep runs ops operations, after an untimed setup. */
+typedef struct {
+	const char *name;
+	long ops;
+	void (*setup)(void);
+	void (*run)(long ops);
+
+	double ns_per_op, min_ns_per_op;
+	double baseline; /* ns per op, or 0 if unknown */
+} Kernel;
+
+static void
+run_compare(long ops)
+{
+	long sum = 0;
+	for (long i = 0; i < ops; ++i) {
+		WordColor wc;
+		compare_to_target(wc, &dict.words[pairs[i].guess], &dict.words[pairs[i].target]);
+		sum += wc[0] + wc[4];
+	}
+	sink = sum;
+}
+
+static void
+run_patterns(long ops)
+{
+	long sum = 0;
+	for (long i = 0; i < ops; ++i) {
+		planes_patterns(codes, &game.opt_planes, &dict.words[pairs[i].guess], 0, planes_blocks(&game.opt_planes));
+		sum += codes[i % game.num_opts];
+	}
+	sink = sum;
+}
+
+static void
+run_knowledge(long ops)
+{
+	long sum = 0;
+	for (long i = 0; i < ops; ++i) {
+		Know k;
+		knowledge_from_colors(&k, &dict.words[pairs[i].guess], pairs[i].colors);
+		sum += k.exclude[0];
+	}
+	sink = sum;
+}
+
+static void
+run_absorb(long ops)
+{
+	long sum = 0;
+	for (long i = 0; i < ops; ++i) {
+		Know k = state_know[i % NUM_STATES];
+		absorb_knowledge(&k, &pairs[i].know);
+		sum += k.exclude[0];
+	}
+	sink = sum;
+}
+
+static void
+run_matches(long ops)
+{
+	long sum = 0;
+	for (long i = 0; i < ops; ++i)
+		sum += word_matches(opt_word(&game, i % game.num_opts), &pairs[i].know);
+	sink = sum;
+}
+
+static void
+run_lookup(long ops)
+{
+	long sum = 0;
+	for (long i = 0; i < ops; ++i)
+		sum += index_of_word(&dict, &dict.words[pairs[i].guess]);
+	sink = sum;
+}
+
+static void
+run_count(long ops)
+{
+	long sum = 0;
+	for (long i = 0; i < ops; ++i)
+		sum += count_opts(&game, &pairs[i].know);
+	sink = sum;
+}
+
+static void
+setup_filter(void)
+{
+	Know none = { 0 };
+	for (int i = 0; i < NUM_STATES; ++i) {
+		game_free(&filter_games[i]);
+		if (game_init_from(&filter_games[i], &game, &none) < 0)
+			exit(1);
+	}
+}
+
+static void
+run_filter(long ops)
+{
+	long sum = 0;
+	for (long i = 0; i < ops; ++i) {
+		if (filter_opts(&filter_games[i], &pairs[i].know) < 0)
+			exit(1);
+		sum += filter_games[i].num_opts;
+	}
+	sink = sum;
+}
+
+static void
+run_score(long ops)
+{
+	double sum = 0.0;
+	for (long i = 0; i < ops; ++i) {
+		int s = i % NUM_STATES;
+		sum += score_guess_st(&state_games[s], &dict.words[pairs[i].guess], NULL, &state_know[s], -INFINITY);
+	}
+	sink = sum;
+}
+
+static void
+setup_best(void)
+{
+	if (guess_cache_clear(&dict) < 0)
+		exit(1);
+}
+
+static void
+run_best(long ops)
+{
+	long sum = 0;
+	for (long i = 0; i < ops; ++i) {
+		int n;
+		best_guesses(&state_games[i], top, dict.num_words, &n, &state_know[i]);
+		sum += n;
+	}
+	sink = sum;
+}
+
+static Kernel kernels[] = {
+	{ .name = "compare_to_target",     .ops = NUM_PAIRS,  .setup = NULL,         .run = run_compare   },
+	{ .name = "planes_patterns",       .ops = 256,        .setup = NULL,         .run = run_patterns  },
+	{ .name = "knowledge_from_colors", .ops = NUM_PAIRS,  .setup = NULL,         .run = run_knowledge },
+	{ .name = "absorb_knowledge",      .ops = NUM_PAIRS,  .setup = NULL,         .run = run_absorb    },
+	{ .name = "word_matches",          .ops = NUM_PAIRS,  .setup = NULL,         .run = run_matches   },
+	{ .name = "index_of_word",         .ops = NUM_PAIRS,  .setup = NULL,         .run = run_lookup    },
+	{ .name = "count_opts",            .ops = 256,        .setup = NULL,         .run = run_count     },
+	{ .name = "filter_opts",           .ops = NUM_STATES, .setup = setup_filter, .run = run_filter    },
+	{ .name = "score_guess_st",        .ops = 256,        .setup = NULL,         .run = run_score     },
+	{ .name = "best_guesses",          .ops = NUM_STATES, .setup = setup_best,   .run = run_best      },
+};
+
+#define NUM_KERNELS (sizeof(kernels) / sizeof(kernels[0]))
+
+static double
+now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int
+compare_doubles(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+/* The median over reps is what gets compared; the minimum shows how
+ * noisy the machine was. */
+static void
+measure(Kernel *k)
+{
+	double *times = malloc(sizeof(double) * reps);
+	if (times == NULL) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+
+	for (int r = -warmup; r < reps; ++r) {
+		if (k->setup != NULL)
+			k->setup();
+
+		double start = now_ns();
+		k->run(k->ops);
+		double end = now_ns();
+
+		if (r >= 0)
+			times[r] = (end - start) / k->ops;
+	}
+
+	qsort(times, reps, sizeof(double), compare_doubles);
+	k->ns_per_op = (reps % 2) ? times[reps / 2] : (times[reps / 2 - 1] + times[reps / 2]) / 2;
+	k->min_ns_per_op = times[0];
+	free(times);
+}
+
+/* Words with roughly English letter frequencies, every fourth one a
+ * target. */
+static void
+make_synthetic_index(void)
+{
+	static const char letters[] = "EEEEEAAAARRRIIIOOOTTTNNNSSSLLCCUUDDPMHGBFYWKVXZJQ";
+
+	dict.num_words = synthetic_words;
+	dict.words = malloc(sizeof(Word) * synthetic_words);
+	dict.attrs = malloc(sizeof(WordAttr) * synthetic_words);
+	if (dict.words == NULL || dict.attrs == NULL) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+
+	for (int i = 0; i < synthetic_words; ++i) {
+		char buf[6];
+		for (int j = 0; j < 5; ++j)
+			buf[j] = letters[rand() % (sizeof(letters) - 1)];
+
+		FILE *f = fmemopen(buf, 5, "r");
+		scan_word(&dict, f, &dict.words[i]);
+		fclose(f);
+
+		dict.attrs[i].starting_score = 0;
+		dict.attrs[i].flags = (i % 4 == 0) ? WA_TARGET : 0;
+	}
+
+	if (init_index(&dict) < 0)
+		exit(1);
+}
+
+static void
+load(void)
+{
+	srand(seed);
+	dict_init(&dict);
+
+	if (index_path != NULL) {
+		FILE *f = fopen(index_path, "rb");
+		if (f == NULL) {
+			perror(index_path);
+			exit(1);
+		}
+
+		if (load_index(&dict, f) < 0)
+			exit(1);
+
+		fclose(f);
+	} else {
+		make_synthetic_index();
+	}
+
+	if (game_init(&game, &dict) < 0 || game.num_opts == 0) {
+		fprintf(stderr, "error: index has no targets\n");
+		exit(1);
+	}
+
+	for (int i = 0; i < NUM_PAIRS; ++i) {
+		pairs[i].guess = rand() % dict.num_words;
+		pairs[i].target = game.opts[rand() % game.num_opts];
+		compare_to_target(pairs[i].colors, &dict.words[pairs[i].guess], &dict.words[pairs[i].target]);
+		knowledge_from_colors(&pairs[i].know, &dict.words[pairs[i].guess], pairs[i].colors);
+	}
+
+	/* past the opener, so that best_guesses has to search */
+	for (int s = 0; s < NUM_STATES; ++s) {
+		do {
+			int p = rand() % NUM_PAIRS;
+			Know k = pairs[p].know;
+			const Word *target = &dict.words[pairs[p].target];
+			const Word *guess = &dict.words[rand() % dict.num_words];
+
+			WordColor wc;
+			Know new;
+			compare_to_target(wc, guess, target);
+			knowledge_from_colors(&new, guess, wc);
+			absorb_knowledge(&k, &new);
+			state_know[s] = k;
+
+			game_free(&state_games[s]);
+			if (game_init_from(&state_games[s], &game, &k) < 0)
+				exit(1);
+		} while (state_games[s].num_opts < 3);
+	}
+
+	top = malloc(sizeof(Word) * dict.num_words);
+	codes = malloc(game.opt_planes.capacity);
+	if (top == NULL || codes == NULL) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+}
+
+/* Reads the nsPerOp of each kernel from earlier output. */
+static void
+read_baseline(void)
+{
+	FILE *f = fopen(baseline_path, "rb");
+	if (f == NULL) {
+		perror(baseline_path);
+		exit(1);
+	}
+
+	char *buf = NULL;
+	size_t size = 0, len = 0;
+	for (;;) {
+		if (len + 4096 > size) {
+			size = size ? 2 * size : 65536;
+			char *new_buf = realloc(buf, size);
+			if (new_buf == NULL) {
+				fprintf(stderr, "out of memory\n");
+				exit(1);
+			}
+			buf = new_buf;
+		}
+
+		size_t n = fread(buf + len, 1, size - len - 1, f);
+		len += n;
+		if (n == 0)
+			break;
+	}
+	buf[len] = '\0';
+	fclose(f);
+
+	for (size_t i = 0; i < NUM_KERNELS; ++i) {
+		char key[64];
+		snprintf(key, sizeof(key), "\"name\":\"%s\"", kernels[i].name);
+
+		char *entry = strstr(buf, key);
+		char *value = entry ? strstr(entry, "\"nsPerOp\":") : NULL;
+		if (value != NULL)
+			kernels[i].baseline = strtod(value + 10, NULL);
+	}
+
+	free(buf);
+}
+
+static int
+report(void)
+{
+	JSONWriter writer;
+	JSONWriter *json = &writer;
+	json_writer_init(json, stdout);
+
+	json_enter_dict(json);
+
+	json_enter_assoc(json, "index");
+	json_string(json, index_path ? index_path : "synthetic");
+	json_leave_assoc(json);
+
+	json_enter_assoc(json, "words");
+	json_int(json, dict.num_words);
+	json_leave_assoc(json);
+
+	json_enter_assoc(json, "targets");
+	json_int(json, game.num_opts);
+	json_leave_assoc(json);
+
+	int regressions = 0;
+
+	json_enter_assoc(json, "kernels");
+	json_enter_list(json);
+	for (size_t i = 0; i < NUM_KERNELS; ++i) {
+		const Kernel *k = &kernels[i];
+		if (only != NULL && strcmp(only, k->name))
+			continue;
+
+		json_enter_dict(json);
+
+		json_enter_assoc(json, "name");
+		json_string(json, k->name);
+		json_leave_assoc(json);
+
+		json_enter_assoc(json, "opsPerRep");
+		json_int(json, k->ops);
+		json_leave_assoc(json);
+
+		json_enter_assoc(json, "nsPerOp");
+		json_double(json, k->ns_per_op);
+		json_leave_assoc(json);
+
+		json_enter_assoc(json, "minNsPerOp");
+		json_double(json, k->min_ns_per_op);
+		json_leave_assoc(json);
+
+		json_enter_assoc(json, "opsPerSecond");
+		json_double(json, 1e9 / k->ns_per_op);
+		json_leave_assoc(json);
+
+		if (k->baseline > 0.0) {
+			double change = (k->ns_per_op / k->baseline - 1.0) * 100.0;
+			if (change > threshold)
+				++regressions;
+
+			json_enter_assoc(json, "baselineNsPerOp");
+			json_double(json, k->baseline);
+			json_leave_assoc(json);
+
+			/* percent, positive is slower */
+			json_enter_assoc(json, "change");
+			json_double(json, change);
+			json_leave_assoc(json);
+		}
+
+		json_leave_dict(json);
+	}
+	json_leave_list(json);
+	json_leave_assoc(json);
+
+	if (baseline_path != NULL) {
+		json_enter_assoc(json, "regressions");
+		json_int(json, regressions);
+		json_leave_assoc(json);
+	}
+
+	json_leave_dict(json);
+	putchar('\n');
+	json_writer_destroy(json);
+
+	return regressions;
+}
+
+static void
+print_usage(void)
+{
+	printf("Usage: %s [OPTION]... [INDEX]\n"
+	       "Benchmark word1e kernels on INDEX, or on a synthetic index.\n\n"
+	       "Options:\n"
+	       "  -b PATH               Compare with earlier output at PATH.\n"
+	       "  -k NAME               Only run the kernel NAME.\n"
+	       "  -n COUNT              Words in the synthetic index (default 4000).\n"
+	       "  -r COUNT              Timed repetitions (default 20).\n"
+	       "  -s SEED               Seed for the synthetic index and inputs.\n"
+	       "  -t PERCENT            Slowdown that counts as a regression\n"
+	       "                        (default 10).\n"
+	       "  -w COUNT              Warm-up repetitions (default 3).\n"
+	       "  --help                Show this message.\n\n"
+	       "Exits with 2 if any kernel regressed.\n", cmd);
+}
+
+static int
+handle_value_option(int *arg_idx,
+                    int argc,
+                    char **argv,
+                    const char *opt_name,
+                    const char **target)
+{
+	if (argc <= *arg_idx + 1) {
+		fprintf(stderr, "expected argument after %s\n", opt_name);
+		print_usage();
+		return -1;
+	}
+
+	*target = argv[++*arg_idx];
+	return 0;
+}
+
+static int
+handle_count_option(int *arg_idx, int argc, char **argv, const char *opt_name, int min, int *target)
+{
+	const char *value;
+	if (handle_value_option(arg_idx, argc, argv, opt_name, &value) < 0)
+		return -1;
+
+	*target = atoi(value);
+	if (*target < min) {
+		fprintf(stderr, "expected count of at least %d after %s\n", min, opt_name);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int
+handle_option(char opt, int *arg_idx, int argc, char **argv)
+{
+	const char *value;
+
+	switch (opt) {
+	case 'b':
+		return handle_value_option(arg_idx, argc, argv, "-b", &baseline_path);
+	case 'k':
+		return handle_value_option(arg_idx, argc, argv, "-k", &only);
+	case 'n':
+		return handle_count_option(arg_idx, argc, argv, "-n", 1, &synthetic_words);
+	case 'r':
+		return handle_count_option(arg_idx, argc, argv, "-r", 1, &reps);
+	case 'w':
+		return handle_count_option(arg_idx, argc, argv, "-w", 0, &warmup);
+	case 's':
+		if (handle_value_option(arg_idx, argc, argv, "-s", &value) < 0)
+			return -1;
+		seed = strtoul(value, NULL, 10);
+		break;
+	case 't':
+		if (handle_value_option(arg_idx, argc, argv, "-t", &value) < 0)
+			return -1;
+		threshold = atof(value);
+		break;
+	default:
+		fprintf(stderr, "unknown option '%c'\n", opt);
+		print_usage();
+		return -1;
+	}
+	return 0;
+}
+static int
+handle_arg(const char *arg, int *arg_idx, int argc, char **argv)
+{
+	if (arg[0] != '-') {
+		index_path = arg;
+		return 0;
+	}
+
+	if (0 == strcmp(arg, "--help")) {
+		print_usage();
+		exit(0);
+	}
+
+	if (arg[1] == '-') {
+		fprintf(stderr, "unknown option `%s'\n", arg);
+		return -1;
+	}
+
+	for (int i = 1; arg[i]; ++i)
+		if (handle_option(arg[i], arg_idx, argc, argv))
+			return -1;
+
+	return 0;
+}
+static int
+handle_args(int argc, char **argv)
+{
+	cmd = argv[0];
+
+	for (int i = 1; i < argc; ++i)
+		if (handle_arg(argv[i], &i, argc, argv))
+			return -1;
+
+	return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+	if (handle_args(argc, argv) < 0)
+		exit(1);
+
+	load();
+
+	if (baseline_path != NULL)
+		read_baseline();
+
+	bool found = false;
+	for (size_t i = 0; i < NUM_KERNELS; ++i) {
+		if (only != NULL && strcmp(only, kernels[i].name))
+			continue;
+
+		measure(&kernels[i]);
+		found = true;
+	}
+
+	if (!found) {
+		fprintf(stderr, "unknown kernel `%s'\n", only);
+		exit(1);
+	}
+
+	int regressions = report();
+
+	for (int i = 0; i < NUM_STATES; ++i) {
+		game_free(&state_games[i]);
+		game_free(&filter_games[i]);
+	}
+	free(top);
+	free(codes);
+	game_free(&game);
+	dict_free(&dict);
+
+	return regressions ? 2 : 0;
+}
@@ -24,19 +24,25 @@
 #include <stdlib.h>
 #include <time.h>
 #include <word.h>
-#include <score.h>
+#include <game.h>
+#include <tree.h>
 #include "json.h"
 
 static char *cmd;
 static Word target, *guesses, *top_words_buf;
 static int num_guesses, max_top_words;
 static JSONWriter *json;
+static DecisionTree tree;
+static bool have_tree, have_target;
+static Dict dict;
+static Game game;
+static ScoreStats stats; /* collected with --stats */
 
 static int
 load_word(char *word_str, Word *word)
 {
 	FILE *f = fmemopen((void *)word_str, strlen(word_str), "r");
-	int c = scan_word(f, word);
+	int c = scan_word(&dict, f, word);
 	fclose(f);
 
 	if (c < 0) {
@@ -50,6 +56,11 @@ load_word(char *word_str, Word *word)
 static int
 handle_string_option(const char *arg, int *arg_idx, int argc, char **argv)
 {
+	if (0 == strcmp(arg, "--stats")) {
+		game.stats = &stats;
+		return 0;
+	}
+
 	fprintf(stderr, "unknown option `%s'\n", arg);
 	return -1;
 }
@@ -63,7 +74,11 @@ handle_option(char opt, int *arg_idx, int argc, char **argv)
 			return -1;
 		}
 
-		return load_word(argv[++*arg_idx], &target);
+		if (load_word(argv[++*arg_idx], &target) < 0)
+			return -1;
+
+		have_target = true;
+		return 0;
 	default:
 		fprintf(stderr, "unknown option `%c'\n", opt);
 		return -1;
@@ -99,7 +114,7 @@ handle_args(int argc, char **argv)
 static int
 check_target_loaded(void)
 {
-	if (target.letters[0] == '\0') {
+	if (!have_target) {
 		fprintf(stderr, "target not loaded\n");
 		return -1;
 	}
@@ -121,7 +136,7 @@ prep_guesses(Know *k, int n)
 		absorb_knowledge(k, &new);
 	}
 
-	if (update_opts(k) < 0)
+	if (update_opts(&game, k) < 0)
 		exit(1);
 }
 
@@ -129,7 +144,8 @@ static void
 jsonify_word(const Word *word)
 {
 	char word_string[6];
-	memcpy(word_string, word->letters, 5);
+	for (int i = 0; i < 5; ++i)
+		word_string[i] = word_letter(word, i);
 	word_string[5] = '\0';
 
 	json_string(json, word_string);
@@ -151,6 +167,43 @@ report_word(const Word *word, double score)
 	json_leave_dict(json);
 }
 
+static void
+report_long(const char *key, long value)
+{
+	json_enter_assoc(json, key);
+	json_long(json, value);
+	json_leave_assoc(json);
+}
+
+static void
+report_double(const char *key, double value)
+{
+	json_enter_assoc(json, key);
+	json_double(json, value);
+	json_leave_assoc(json);
+}
+
+/* What the scoring did since the last report. */
+static void
+report_stats(void)
+{
+	json_enter_dict(json);
+	report_long("guesses", stats.guesses);
+	report_long("targets", stats.targets);
+	report_long("breaks", stats.breaks);
+	report_double("breakDepth", score_stats_break_depth(&stats));
+	report_long("calls", stats.calls);
+	report_long("searches", stats.searches);
+	report_double("shortcutMs", stats.shortcut_ns / 1e6);
+	report_double("candidatesMs", stats.candidates_ns / 1e6);
+	report_double("scoringMs", stats.scoring_ns / 1e6);
+	report_double("mergeMs", stats.merge_ns / 1e6);
+	report_double("taskImbalance", score_stats_imbalance(&stats));
+	json_leave_dict(json);
+
+	score_stats_reset(&stats);
+}
+
 static int
 report(const Word *user,
        double user_score,
@@ -193,8 +246,8 @@ report(const Word *user,
 	json_enter_assoc(json, "optionsLeft");
 	json_enter_list(json);
 
-	for (int i = 0; i < num_opts; ++i)
-		jsonify_word(&opts[i]);
+	for (int i = 0; i < game.num_opts; ++i)
+		jsonify_word(opt_word(&game, i));
 
 	json_leave_list(json);
 	json_leave_assoc(json);
@@ -203,6 +256,12 @@ report(const Word *user,
 	json_int(json, eliminated);
 	json_leave_assoc(json);
 
+	if (game.stats != NULL) {
+		json_enter_assoc(json, "stats");
+		report_stats();
+		json_leave_assoc(json);
+	}
+
 	json_leave_dict(json);
 	return 0;
 }
@@ -213,16 +272,33 @@ select_guess(const Word **guess_out, const Word *top_words_buf, int num_top, int
 	if (guess_idx > 0) {
 		*guess_out = &top_words_buf[0];
 	} else {
-		int max = num_words / 50;
+		int max = dict.num_words / 50;
 		if (max < 100)
 			max = 100;
-		if (max >= num_words)
-			max = num_words;
+		if (max >= dict.num_words)
+			max = dict.num_words;
 
-		*guess_out = &all_words[rand() % max];
+		*guess_out = &dict.words[rand() % max];
 	}
 }
 
+/* Node of the tree reached by the first n guesses, or -1. */
+static int
+follow_tree(int n)
+{
+	if (!have_tree)
+		return -1;
+
+	int node = 0;
+	for (int i = 0; i < n && node >= 0; ++i) {
+		WordColor wc;
+		compare_to_target(wc, &guesses[i], &target);
+		node = tree_child(&tree, node, index_of_word(&dict, &guesses[i]), wc);
+	}
+
+	return node;
+}
+
 static int
 solve(int argc, char **argv)
 {
@@ -233,11 +309,16 @@ solve(int argc, char **argv)
 
 	Know k;
 	prep_guesses(&k, num_guesses);
+	int node = follow_tree(num_guesses);
 
 	json_enter_list(json);
-	for (int i = num_guesses; num_opts > 0; ++i) {
+	for (int i = num_guesses; game.num_opts > 0; ++i) {
 		int n;
-		double best_score = best_guesses(top_words_buf, max_top_words, &n, &k);
+		double best_score;
+		if (node >= 0)
+			best_score = tree_best(&tree, &dict, node, top_words_buf, max_top_words, &n);
+		else
+			best_score = best_guesses(&game, top_words_buf, max_top_words, &n, &k);
 
 		/* shouldn't happen, but let's be safe */
 		if (n <= 0)
@@ -254,7 +335,10 @@ solve(int argc, char **argv)
 
 		absorb_knowledge(&k, &new);
 
-		int elim = update_opts(&k);
+		if (node >= 0)
+			node = tree_child(&tree, node, index_of_word(&dict, guess), wc);
+
+		int elim = update_opts(&game, &k);
 		if (elim < 0)
 			return 1;
 
@@ -285,10 +369,10 @@ coach(int argc, char **argv)
 	prep_guesses(&k, num_guesses - 1);
 
 	Word *user_guess = &guesses[num_guesses - 1];
-	double user_score = score_guess(user_guess, &k);
+	double user_score = score_guess(&game, user_guess, &k);
 
 	int n;
-	double best_score = best_guesses(top_words_buf, max_top_words, &n, &k);
+	double best_score = best_guesses(&game, top_words_buf, max_top_words, &n, &k);
 
 	WordColor wc;
 	compare_to_target(wc, user_guess, &target);
@@ -298,7 +382,7 @@ coach(int argc, char **argv)
 
 	absorb_knowledge(&k, &new);
 
-	int elim = update_opts(&k);
+	int elim = update_opts(&game, &k);
 	if (elim < 0)
 		return 1;
 
@@ -312,9 +396,9 @@ list_flagged(int argc, char **argv, int flag)
 	bool noflag = (flag == 0);
 
 	json_enter_list(json);
-	for (int i = 0; i < num_words; ++i)
-		if (noflag || (word_attrs[i].flags & flag))
-			jsonify_word(&all_words[i]);
+	for (int i = 0; i < dict.num_words; ++i)
+		if (noflag || (dict.attrs[i].flags & flag))
+			jsonify_word(&dict.words[i]);
 	json_leave_list(json);
 
 	return 0;
@@ -397,16 +481,46 @@ main(int argc, char **argv)
 		return 1;
 	}
 
-	int idx_rc = load_index(f);
+	int idx_rc = load_index(&dict, f);
 
 	fclose(f);
 
-	if (idx_rc < 0)
+	if (idx_rc < 0 || game_init(&game, &dict) < 0)
 		return 1;
 
+	char *metric_name = getenv("WORDSMITH_METRIC");
+	if (metric_name != NULL) {
+		int metric = score_metric_from_name(metric_name);
+		if (metric < 0) {
+			fprintf(stderr, "unknown metric `%s'\n", metric_name);
+			return 1;
+		}
+
+		game.score_metric = metric;
+	}
+
+	/* optional, for solving without scoring */
+	char *tree_file = getenv("WORDSMITH_TREE");
+	if (tree_file != NULL) {
+		f = fopen(tree_file, "rb");
+		if (f == NULL) {
+			perror(tree_file);
+			return 1;
+		}
+
+		int tree_rc = tree_load(&tree, &dict, f);
+
+		fclose(f);
+
+		if (tree_rc < 0)
+			return 1;
+
+		have_tree = true;
+	}
+
 	num_guesses = 0;
 	guesses = malloc(argc * sizeof(Word));
-	max_top_words = num_words;
+	max_top_words = dict.num_words;
 	top_words_buf = malloc(sizeof(Word) * max_top_words);
 
 	if (guesses == NULL || top_words_buf == NULL) {
@@ -425,10 +539,11 @@ main(int argc, char **argv)
 	putchar('\n');
 
 	json_writer_destroy(json);
+	tree_free(&tree);
 	free(top_words_buf);
 	free(guesses);
-	free(opts);
-	free(all_words);
+	game_free(&game);
+	dict_free(&dict);
 
 	return rc;
 }